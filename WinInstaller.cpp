@@ -4,105 +4,3961 @@
 #include <cstdlib>
 #include <fstream>
 #include <array>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <cctype>
+#include <random>
+#include <ctime>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#define _popen popen
+#define _pclose pclose
+#endif
 
 namespace fs = std::filesystem;
 
-// 错误处理
-#define CHECK(condition, message) \
-    if (!(condition)) { \
-        std::cerr << "[ERROR] " << message << std::endl; \
-        exit(EXIT_FAILURE); \
+// 错误处理
+#define CHECK(condition, message) \
+    if (!(condition)) { \
+        std::cerr << "[ERROR] " << message << std::endl; \
+        exit(EXIT_FAILURE); \
+    }
+
+// 系统配置结构体
+struct Config {
+    std::string select_mode;
+    std::string image_path;
+    int image_index = 1;  // 默认索引（Windows索引从1开始）
+    bool backup_drive = false;
+    bool remote_iso = true;  // 预置模式下按需读取远程ISO，只下载install.wim
+    std::string iso_url;     // 覆盖预置的ISO下载地址
+    bool single_image = true;  // 远程下载时只取所选版本的资源，生成单镜像WIM
+    bool prefetch = false;     // 后台预取：只下载、校验并预处理镜像，不动目标分区
+    std::string rate_limit;    // 下载限速，例如 500K、2M
+    std::string fat32_image;   // 非空时把PE分区内容排成FAT32卷一次写出；\\.\B: 表示直接写PE分区，普通文件仅限 --replay
+};
+
+// ==================== 执行后端 ====================
+
+// 回放脚本中的一条规则：命令包含 match 时不真正执行，而是等待 delay_ms 后返回 exit_code，
+// 可选动作：echo 文本（\n 表示换行）、copy 源 目标、mkdir 目录、touch 文件；{peroot} 替换为PE分区根目录
+struct ReplayRule {
+    std::string match;
+    int delay_ms = 0;
+    int exit_code = 0;
+    std::string action;
+};
+
+// 外部命令与PE分区根目录的抽象。正常运行时执行真实命令、写入 B:\；
+// 回放模式（--replay）下按脚本模拟命令，PE分区由 --peroot 指定的目录代替，未匹配的命令照常执行
+class CommandBackend {
+public:
+    const fs::path& PeRoot() const { return pe_root_; }
+    void SetPeRoot(const fs::path& root) { pe_root_ = root; }
+    bool Replaying() const { return !rules_.empty(); }
+
+    // 脚本每行一条规则：匹配子串|延迟毫秒|退出码|动作，空行和 # 开头的行忽略
+    bool LoadReplayScript(const fs::path& path) {
+        std::ifstream in(path);
+        if (!in) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+            std::vector<std::string> fields;
+            size_t start = 0;
+            for (int i = 0; i < 3; ++i) {
+                size_t bar = line.find('|', start);
+                if (bar == std::string::npos) break;
+                fields.push_back(line.substr(start, bar - start));
+                start = bar + 1;
+            }
+            fields.push_back(line.substr(start));
+            if (fields.size() < 3 || fields[0].empty()) return false;
+            ReplayRule rule;
+            rule.match = fields[0];
+            try {
+                rule.delay_ms = std::stoi(fields[1]);
+                rule.exit_code = std::stoi(fields[2]);
+            } catch (const std::exception&) {
+                return false;
+            }
+            if (fields.size() > 3) rule.action = fields[3];
+            rules_.push_back(rule);
+        }
+        return true;
+    }
+
+    // 与 system() 相同：返回退出码
+    int Run(const std::string& cmd) {
+        if (const ReplayRule* rule = Match(cmd)) {
+            std::string output = Simulate(*rule);
+            std::cout << output;
+            return rule->exit_code;
+        }
+        return std::system(cmd.c_str());
+    }
+
+    // 执行命令并把标准输出交给 sink；sink 返回false时提前停止读取，返回退出码
+    int Capture(const std::string& cmd, bool binary, const std::function<bool(const uint8_t*, size_t)>& sink) {
+        if (const ReplayRule* rule = Match(cmd)) {
+            std::string output = Simulate(*rule);
+            if (!output.empty()) sink(reinterpret_cast<const uint8_t*>(output.data()), output.size());
+            return rule->exit_code;
+        }
+#ifdef _WIN32
+        FILE* pipe = _popen(cmd.c_str(), binary ? "rb" : "r");
+#else
+        (void)binary;
+        FILE* pipe = _popen(cmd.c_str(), "r");
+#endif
+        if (!pipe) {
+            throw std::runtime_error("popen() failed!");
+        }
+        std::vector<uint8_t> buffer(1 << 16);
+        size_t n;
+        while ((n = fread(buffer.data(), 1, buffer.size(), pipe)) > 0) {
+            if (!sink(buffer.data(), n)) break;
+        }
+        return _pclose(pipe);
+    }
+
+private:
+    const ReplayRule* Match(const std::string& cmd) const {
+        for (const auto& rule : rules_) {
+            if (cmd.find(rule.match) != std::string::npos) return &rule;
+        }
+        return nullptr;
+    }
+
+    std::string Expand(std::string text) const {
+        const std::string key = "{peroot}";
+        for (size_t pos; (pos = text.find(key)) != std::string::npos;) text.replace(pos, key.size(), pe_root_.string());
+        return text;
+    }
+
+    // 执行规则的延迟与动作，返回模拟的标准输出
+    std::string Simulate(const ReplayRule& rule) const {
+        if (rule.delay_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(rule.delay_ms));
+        std::string action = Expand(rule.action);
+        size_t space = action.find(' ');
+        std::string verb = action.substr(0, space);
+        std::string rest = space == std::string::npos ? std::string() : action.substr(space + 1);
+        if (verb == "echo") {
+            std::string output;
+            for (size_t i = 0; i < rest.size(); ++i) {
+                if (rest[i] == '\\' && i + 1 < rest.size() && rest[i + 1] == 'n') {
+                    output += '\n';
+                    ++i;
+                } else {
+                    output += rest[i];
+                }
+            }
+            return output + "\n";
+        }
+        if (verb == "copy") {
+            size_t split = rest.find(' ');
+            if (split == std::string::npos) throw std::runtime_error("replay copy needs source and target");
+            fs::path source = rest.substr(0, split), target = rest.substr(split + 1);
+            if (fs::is_directory(target)) target /= source.filename();
+            fs::create_directories(target.parent_path());
+            fs::copy_file(source, target, fs::copy_options::overwrite_existing);
+        } else if (verb == "mkdir") {
+            fs::create_directories(rest);
+        } else if (verb == "touch") {
+            std::ofstream touch(rest, std::ios::app);
+        } else if (!verb.empty()) {
+            throw std::runtime_error("unknown replay action: " + verb);
+        }
+        return std::string();
+    }
+
+    fs::path pe_root_ = "B:\\";
+    std::vector<ReplayRule> rules_;
+};
+
+CommandBackend& Backend() {
+    static CommandBackend backend;
+    return backend;
+}
+
+// PE分区根目录（正常为 B:\）
+const fs::path& PeRoot() {
+    return Backend().PeRoot();
+}
+
+// 执行命令并检查结果
+void ExecuteCommand(const std::string& cmd) {
+    std::cout << "[EXEC] " << cmd << std::endl;
+    int result = Backend().Run(cmd);
+    CHECK(result == 0, "Command failed: " + cmd);
+}
+
+// 下载限速（字节/秒，0为不限），由 --ratelimit 设置，所有curl调用共用
+uint64_t g_rate_limit = 0;
+
+// 并行下载时总带宽按连接数平分
+std::string CurlRateOption(unsigned connections = 1) {
+    if (g_rate_limit == 0) return "";
+    return " --limit-rate " + std::to_string(std::max<uint64_t>(g_rate_limit / connections, 1024));
+}
+
+// 解析 500K / 2M / 1G / 纯字节数
+bool ParseRateLimit(const std::string& text, uint64_t& bytes) {
+    if (text.empty()) return false;
+    size_t digits = 0;
+    while (digits < text.size() && isdigit(uint8_t(text[digits]))) ++digits;
+    if (digits == 0 || digits + 1 < text.size()) return false;
+    bytes = std::stoull(text.substr(0, digits));
+    if (digits < text.size()) {
+        switch (toupper(uint8_t(text[digits]))) {
+            case 'K': bytes <<= 10; break;
+            case 'M': bytes <<= 20; break;
+            case 'G': bytes <<= 30; break;
+            default: return false;
+        }
+    }
+    return bytes > 0;
+}
+
+// 后台模式：降低CPU与磁盘I/O优先级，之后启动的curl/7z/dism继承较低的优先级类
+void EnterBackgroundMode() {
+#ifdef _WIN32
+    SetPriorityClass(GetCurrentProcess(), IDLE_PRIORITY_CLASS);
+    SetPriorityClass(GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN);
+#else
+    setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_ioprio_set
+    // 磁盘I/O改为idle类（IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT），只在磁盘空闲时得到服务
+    const int kIoprioWhoProcess = 1, kIoprioClassIdle = 3, kIoprioClassShift = 13;
+    syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, kIoprioClassIdle << kIoprioClassShift);
+#endif
+#endif
+}
+
+// 执行命令行并返回输出
+std::string exec(const char* cmd) {
+    std::string result;
+    Backend().Capture(cmd, false, [&](const uint8_t* p, size_t n) {
+        result.append(reinterpret_cast<const char*>(p), n);
+        return true;
+    });
+    return result;
+}
+
+// 执行命令并以二进制方式把输出交给 sink；sink 返回false时提前停止读取，返回命令退出码
+int execBinary(const std::string& cmd, const std::function<bool(const uint8_t*, size_t)>& sink) {
+    return Backend().Capture(cmd, true, sink);
+}
+
+// 获取文件的MD5哈希
+std::string getFileMD5(const std::string& filePath) {
+    // 构建certutil命令
+    std::string command = "certutil -hashfile \"" + filePath + "\" MD5";
+
+    // 执行命令并获取输出
+    std::string output = exec(command.c_str());
+
+    // 从输出中提取MD5哈希值
+    size_t pos = output.find("\n");
+    if (pos != std::string::npos) {
+        size_t endPos = output.find("\n", pos + 1);
+        if (endPos != std::string::npos) {
+            std::string md5 = output.substr(pos + 1, endPos - pos - 1);
+            // 去除可能的空白字符
+            md5.erase(md5.find_last_not_of(" \n\r\t") + 1);
+            return md5;
+        }
+    }
+
+    return ""; // 如果未找到MD5哈希值，返回空字符串
+}
+
+// 文件存在性检查函数
+bool fileExists(const std::string& filename) {
+    std::ifstream file(filename);
+    return file.good();
+}
+
+//下载文件
+void downloadAndVerifyFile(
+    const std::string& filename,
+    const std::string& downloadPath,
+    const std::string& expectedMD5
+) {
+    while (true) {
+        // 文件存在性检验
+        if (!fileExists(filename)) {
+            std::cout << "即将开始下载..." << std::endl;
+            std::string cmd = "curl" + CurlRateOption() + " -o \"" + filename + "\" \"" + downloadPath + "\"";
+            Backend().Run(cmd);
+            // 下载失败时不再去校验一个不存在的文件
+            CHECK(fileExists(filename), "Download failed: " + filename);
+        } else {
+            std::cout << "文件已存在！\n" << std::endl;
+        }
+
+        // MD5验证
+        std::cout << "正在验证镜像MD5..." << std::endl;
+        std::string actualMD5 = getFileMD5(filename);
+        
+        if (actualMD5 == expectedMD5) {
+            std::cout << "MD5验证通过！\n" << std::endl;
+            break;
+        } else {
+            std::cout << "MD5验证未通过，即将重新下载...\n" << std::endl;
+            std::string delCmd = "del \"" + filename + "\"";  // 删除未通过验证的文件
+            Backend().Run(delCmd);
+        }
+    }
+}
+
+// ==================== 基础工具 ====================
+
+uint16_t GetLE16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+uint32_t GetLE32(const uint8_t* p) {
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+uint64_t GetLE64(const uint8_t* p) { return uint64_t(GetLE32(p)) | (uint64_t(GetLE32(p + 4)) << 32); }
+
+void PutLE16(uint8_t* p, uint16_t v) { p[0] = uint8_t(v); p[1] = uint8_t(v >> 8); }
+void PutLE32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; ++i) p[i] = uint8_t(v >> (8 * i)); }
+void PutLE64(uint8_t* p, uint64_t v) { for (int i = 0; i < 8; ++i) p[i] = uint8_t(v >> (8 * i)); }
+
+using Sha1Hash = std::array<uint8_t, 20>;
+
+// SHA-1（WIM查找表和完整性表使用的哈希）
+class Sha1 {
+public:
+    Sha1() { Reset(); }
+
+    void Reset() {
+        state_[0] = 0x67452301; state_[1] = 0xEFCDAB89; state_[2] = 0x98BADCFE;
+        state_[3] = 0x10325476; state_[4] = 0xC3D2E1F0;
+        total_ = 0;
+        buffered_ = 0;
+    }
+
+    void Update(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        total_ += len;
+        if (buffered_ > 0) {
+            size_t n = std::min(len, sizeof(buffer_) - buffered_);
+            memcpy(buffer_ + buffered_, p, n);
+            buffered_ += n; p += n; len -= n;
+            if (buffered_ < sizeof(buffer_)) return;
+            Transform(buffer_);
+            buffered_ = 0;
+        }
+        while (len >= 64) { Transform(p); p += 64; len -= 64; }
+        if (len > 0) { memcpy(buffer_, p, len); buffered_ = len; }
+    }
+
+    Sha1Hash Final() {
+        uint64_t bits = total_ * 8;
+        uint8_t pad[128] = {0x80};
+        Update(pad, (buffered_ < 56) ? 56 - buffered_ : 120 - buffered_);
+        uint8_t len_be[8];
+        for (int i = 0; i < 8; ++i) len_be[i] = uint8_t(bits >> (56 - 8 * i));
+        Update(len_be, 8);
+        Sha1Hash out;
+        for (int i = 0; i < 5; ++i) {
+            for (int j = 0; j < 4; ++j) out[i * 4 + j] = uint8_t(state_[i] >> (24 - 8 * j));
+        }
+        return out;
+    }
+
+private:
+    static uint32_t Rol(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+    // 80轮完全展开：五个工作变量轮流充当 a..e，省去每轮的变量搬移；轮函数按段固定，循环内没有分支；
+    // 消息扩展只保留16个字的环形缓冲，在用到时才计算
+    void Transform(const uint8_t* block) {
+        uint32_t w[16];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+                   (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+        }
+        uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3], e = state_[4];
+#define SHA1_W(i) (w[(i) & 15] = Rol(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+#define SHA1_R0(A, B, C, D, E, i) E += (((B) & ((C) ^ (D))) ^ (D)) + w[i] + 0x5A827999 + Rol(A, 5); B = Rol(B, 30);
+#define SHA1_R1(A, B, C, D, E, i) E += (((B) & ((C) ^ (D))) ^ (D)) + SHA1_W(i) + 0x5A827999 + Rol(A, 5); B = Rol(B, 30);
+#define SHA1_R2(A, B, C, D, E, i) E += ((B) ^ (C) ^ (D)) + SHA1_W(i) + 0x6ED9EBA1 + Rol(A, 5); B = Rol(B, 30);
+#define SHA1_R3(A, B, C, D, E, i) E += ((((B) | (C)) & (D)) | ((B) & (C))) + SHA1_W(i) + 0x8F1BBCDC + Rol(A, 5); B = Rol(B, 30);
+#define SHA1_R4(A, B, C, D, E, i) E += ((B) ^ (C) ^ (D)) + SHA1_W(i) + 0xCA62C1D6 + Rol(A, 5); B = Rol(B, 30);
+#define SHA1_5(R, i) R(a, b, c, d, e, i) R(e, a, b, c, d, i + 1) R(d, e, a, b, c, i + 2) R(c, d, e, a, b, i + 3) R(b, c, d, e, a, i + 4)
+        SHA1_5(SHA1_R0, 0) SHA1_5(SHA1_R0, 5) SHA1_5(SHA1_R0, 10)
+        SHA1_R0(a, b, c, d, e, 15) SHA1_R1(e, a, b, c, d, 16) SHA1_R1(d, e, a, b, c, 17) SHA1_R1(c, d, e, a, b, 18) SHA1_R1(b, c, d, e, a, 19)
+        SHA1_5(SHA1_R2, 20) SHA1_5(SHA1_R2, 25) SHA1_5(SHA1_R2, 30) SHA1_5(SHA1_R2, 35)
+        SHA1_5(SHA1_R3, 40) SHA1_5(SHA1_R3, 45) SHA1_5(SHA1_R3, 50) SHA1_5(SHA1_R3, 55)
+        SHA1_5(SHA1_R4, 60) SHA1_5(SHA1_R4, 65) SHA1_5(SHA1_R4, 70) SHA1_5(SHA1_R4, 75)
+#undef SHA1_5
+#undef SHA1_R4
+#undef SHA1_R3
+#undef SHA1_R2
+#undef SHA1_R1
+#undef SHA1_R0
+#undef SHA1_W
+        state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d; state_[4] += e;
+    }
+
+    uint32_t state_[5];
+    uint64_t total_;
+    uint8_t buffer_[64];
+    size_t buffered_;
+};
+
+Sha1Hash ComputeSha1(const void* data, size_t len) {
+    Sha1 sha;
+    sha.Update(data, len);
+    return sha.Final();
+}
+
+bool IsZeroHash(const Sha1Hash& hash) {
+    return std::all_of(hash.begin(), hash.end(), [](uint8_t b) { return b == 0; });
+}
+
+std::string HashToHex(const Sha1Hash& hash) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (uint8_t b : hash) { hex += digits[b >> 4]; hex += digits[b & 0xF]; }
+    return hex;
+}
+
+// 解析40位十六进制（大小写均可），格式不对时返回false
+bool HexToHash(const std::string& hex, Sha1Hash& hash) {
+    if (hex.size() != 40) return false;
+    auto nibble = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        c = char(c | 0x20);
+        return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+    };
+    for (size_t i = 0; i < 20; ++i) {
+        int hi = nibble(hex[i * 2]), lo = nibble(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return false;
+        hash[i] = uint8_t(hi << 4 | lo);
+    }
+    return true;
+}
+
+// ==================== 任务执行器 ====================
+
+// 任务类别：CPU密集（解压、哈希）与I/O密集（下载、读写文件）各用一组线程，互不占用
+enum class TaskClass { Cpu = 0, Io = 1 };
+// 优先级：线程总是先取高优先级的任务（包括从别的线程窃取时）
+enum class TaskPriority { High = 0, Normal = 1, Low = 2 };
+
+class TaskGroup;
+
+// 工作窃取线程池：每个线程有自己的双端队列，本线程从尾部取（LIFO，缓存友好），
+// 空闲线程从其他线程的头部窃取（FIFO，先提交的先做）。等待任务组的线程也会帮忙执行任务
+class Executor {
+public:
+    static const unsigned kExternalSlots = 8;  // 参与执行任务的外部线程（如主线程）数量上限
+    static const unsigned kNoSlot = ~0u;
+
+    // external_slots 为0时外部线程只等待不参与执行（基准测试用，保证线程数准确）
+    Executor(unsigned cpu_threads, unsigned io_threads, unsigned external_slots = kExternalSlots);
+    ~Executor();
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // 全局执行器：CPU线程数等于核数，I/O线程固定8个。有意不析构，CHECK在任务中调用exit()时不会等待自身
+    static Executor& Instance() {
+        static Executor* executor = new Executor(std::max(1u, std::thread::hardware_concurrency()), 8);
+        return *executor;
+    }
+
+    // 槽位：每个执行任务的线程一个固定编号，任务可按槽位使用各自的文件句柄和缓冲区
+    unsigned SlotCount() const { return external_base_ + external_slots_; }
+    unsigned CurrentSlot();
+
+    void Submit(TaskGroup& group, TaskClass cls, TaskPriority priority, std::function<void()> fn);
+
+    // 从任意队列取一个任务在当前线程执行；没有任务或当前线程没有槽位时返回false
+    bool HelpOne();
+
+    void Report(const std::string& label) const;
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        TaskGroup* group = nullptr;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[3];  // 按优先级
+    };
+
+    struct Pool {
+        std::vector<std::unique_ptr<Worker>> workers;
+        unsigned first_slot = 0;
+        std::atomic<size_t> queued{0};
+        std::atomic<size_t> next_victim{0};
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+    };
+
+    struct Metrics {
+        std::atomic<uint64_t> submitted{0};
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        std::atomic<uint64_t> helped{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> wait_ns{0};
+        std::atomic<uint64_t> max_wait_ns{0};
+    };
+
+    // 当前线程作为本执行器工作线程时的身份
+    struct WorkerIdentity {
+        uint64_t executor_id = 0;
+        int pool = -1;
+        unsigned index = 0;
+    };
+    static WorkerIdentity& Self() {
+        static thread_local WorkerIdentity self;
+        return self;
+    }
+
+    static uint64_t NextId() {
+        static std::atomic<uint64_t> next{1};
+        return next++;
+    }
+
+    bool TryTake(Pool& pool, int self, Task& task, bool& stolen);
+    void Execute(TaskClass cls, Task& task, bool stolen, bool helped);
+    void WorkerLoop(int pool_index, unsigned index);
+
+    const uint64_t id_;
+    Pool pools_[2];
+    Metrics metrics_[2];
+    unsigned external_base_ = 0;
+    unsigned external_slots_ = 0;
+    std::atomic<unsigned> external_used_{0};
+    std::atomic<bool> stop_{false};
+    std::vector<std::thread> threads_;
+};
+
+// 一组相关任务：Wait 等待全部完成，等待期间当前线程也参与执行；
+// 任一任务抛出异常后，组内尚未开始的任务直接跳过，第一个异常在 Wait 中重新抛出
+class TaskGroup {
+public:
+    explicit TaskGroup(Executor& executor = Executor::Instance()) : executor_(executor) {}
+    ~TaskGroup() {
+        try {
+            Wait();
+        } catch (...) {
+        }
+    }
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    bool Failed() const { return failed_; }
+
+    void Run(TaskClass cls, TaskPriority priority, std::function<void()> fn) {
+        executor_.Submit(*this, cls, priority, std::move(fn));
+    }
+
+    void Wait() {
+        while (pending_ > 0) {
+            if (executor_.HelpOne()) continue;
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait_for(lock, std::chrono::milliseconds(1), [&] { return pending_ == 0; });
+        }
+        // 加锁一次，确保最后一个任务的 Finish 已经退出临界区，之后才能安全析构
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error_) {
+            std::exception_ptr error = error_;
+            error_ = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    friend class Executor;
+
+    void Fail(std::exception_ptr error) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_) error_ = error;
+        failed_ = true;
+    }
+
+    void Finish() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) done_.notify_all();
+    }
+
+    Executor& executor_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<bool> failed_{false};
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+};
+
+Executor::Executor(unsigned cpu_threads, unsigned io_threads, unsigned external_slots)
+    : id_(NextId()), external_slots_(external_slots) {
+    unsigned counts[2] = {std::max(1u, cpu_threads), std::max(1u, io_threads)};
+    unsigned slot = 0;
+    for (int p = 0; p < 2; ++p) {
+        pools_[p].first_slot = slot;
+        for (unsigned i = 0; i < counts[p]; ++i) pools_[p].workers.push_back(std::make_unique<Worker>());
+        slot += counts[p];
+    }
+    external_base_ = slot;
+    for (int p = 0; p < 2; ++p) {
+        for (unsigned i = 0; i < counts[p]; ++i) threads_.emplace_back(&Executor::WorkerLoop, this, p, i);
+    }
+}
+
+Executor::~Executor() {
+    stop_ = true;
+    for (auto& pool : pools_) {
+        std::lock_guard<std::mutex> lock(pool.sleep_mutex);
+        pool.wake.notify_all();
+    }
+    for (auto& t : threads_) t.join();
+}
+
+unsigned Executor::CurrentSlot() {
+    const WorkerIdentity& self = Self();
+    if (self.executor_id == id_) return pools_[self.pool].first_slot + self.index;
+    // 外部线程第一次参与时分配一个槽位，按执行器编号区分
+    static thread_local std::vector<std::pair<uint64_t, unsigned>> external;
+    for (const auto& e : external) {
+        if (e.first == id_) return e.second;
+    }
+    unsigned n = external_used_++;
+    unsigned slot = n < external_slots_ ? external_base_ + n : kNoSlot;
+    external.emplace_back(id_, slot);
+    return slot;
+}
+
+void Executor::Submit(TaskGroup& group, TaskClass cls, TaskPriority priority, std::function<void()> fn) {
+    Pool& pool = pools_[int(cls)];
+    group.pending_++;
+    metrics_[int(cls)].submitted++;
+    // 工作线程提交到自己的队列，外部线程轮流分给各工作线程
+    const WorkerIdentity& self = Self();
+    size_t target = (self.executor_id == id_ && self.pool == int(cls)) ? self.index
+                                                                       : pool.next_victim++ % pool.workers.size();
+    {
+        Worker& worker = *pool.workers[target];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.queues[int(priority)].push_back({std::move(fn), &group, std::chrono::steady_clock::now()});
+    }
+    pool.queued++;
+    std::lock_guard<std::mutex> lock(pool.sleep_mutex);
+    pool.wake.notify_one();
+}
+
+bool Executor::TryTake(Pool& pool, int self, Task& task, bool& stolen) {
+    const size_t n = pool.workers.size();
+    if (pool.queued == 0) return false;
+    size_t start = self >= 0 ? size_t(self) : pool.next_victim.load() % n;
+    for (int p = 0; p < 3; ++p) {
+        if (self >= 0) {
+            Worker& own = *pool.workers[size_t(self)];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.queues[p].empty()) {
+                task = std::move(own.queues[p].back());
+                own.queues[p].pop_back();
+                pool.queued--;
+                stolen = false;
+                return true;
+            }
+        }
+        for (size_t k = 0; k < n; ++k) {
+            size_t victim = (start + k + 1) % n;
+            if (int(victim) == self) continue;
+            Worker& other = *pool.workers[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.queues[p].empty()) {
+                task = std::move(other.queues[p].front());
+                other.queues[p].pop_front();
+                pool.queued--;
+                stolen = true;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Executor::Execute(TaskClass cls, Task& task, bool stolen, bool helped) {
+    Metrics& m = metrics_[int(cls)];
+    auto start = std::chrono::steady_clock::now();
+    uint64_t wait = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(start - task.queued_at).count());
+    if (!task.group->failed_) {
+        try {
+            task.fn();
+        } catch (...) {
+            task.group->Fail(std::current_exception());
+        }
+    }
+    uint64_t busy = uint64_t(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    m.executed++;
+    if (stolen) m.stolen++;
+    if (helped) m.helped++;
+    m.busy_ns += busy;
+    m.wait_ns += wait;
+    for (uint64_t prev = m.max_wait_ns; wait > prev && !m.max_wait_ns.compare_exchange_weak(prev, wait);) {
+    }
+    TaskGroup* group = task.group;
+    task.fn = nullptr;  // 先释放任务持有的资源，再通知等待者
+    group->Finish();
+}
+
+bool Executor::HelpOne() {
+    if (CurrentSlot() == kNoSlot) return false;
+    const WorkerIdentity& self = Self();
+    for (int p = 0; p < 2; ++p) {
+        Task task;
+        bool stolen = false;
+        int own = (self.executor_id == id_ && self.pool == p) ? int(self.index) : -1;
+        if (TryTake(pools_[p], own, task, stolen)) {
+            Execute(TaskClass(p), task, stolen, own < 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::WorkerLoop(int pool_index, unsigned index) {
+    Self() = {id_, pool_index, index};
+    Pool& pool = pools_[pool_index];
+    while (!stop_) {
+        Task task;
+        bool stolen = false;
+        if (TryTake(pool, int(index), task, stolen)) {
+            Execute(TaskClass(pool_index), task, stolen, false);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(pool.sleep_mutex);
+        pool.wake.wait(lock, [&] { return stop_ || pool.queued > 0; });
+    }
+}
+
+// 输出每类任务的数量、窃取/协助次数、累计执行时间与排队时间
+void Executor::Report(const std::string& label) const {
+    const char* names[2] = {"cpu", "io"};
+    for (int p = 0; p < 2; ++p) {
+        const Metrics& m = metrics_[p];
+        uint64_t executed = m.executed;
+        if (executed == 0) continue;
+        std::cout << "[TASK] " << label << " " << names[p] << "：" << pools_[p].workers.size() << " 线程，"
+                  << executed << " 个任务，窃取 " << m.stolen << "，协助 " << m.helped << "，执行 "
+                  << m.busy_ns / 1000000 << " ms，平均排队 " << m.wait_ns / executed / 1000 << " us，最长排队 "
+                  << m.max_wait_ns / 1000000 << " ms" << std::endl;
+    }
+}
+
+// 在执行器上为 [0, count) 的每个下标提交一个任务并等待完成，任一任务出错时剩余任务跳过并把异常抛给调用者。
+// fn 的第二个参数是执行线程的槽位号（小于 SlotCount()）。max_parallel 非0时限制同时运行的任务数（如下载连接数），
+// 此时任务按下标顺序依次接力提交
+void ParallelFor(size_t count, TaskClass cls, const std::function<void(size_t index, unsigned slot)>& fn,
+                 unsigned max_parallel = 0, TaskPriority priority = TaskPriority::Normal,
+                 Executor& executor = Executor::Instance()) {
+    std::atomic<size_t> next{0};
+    std::function<void()> step;
+    TaskGroup group(executor);  // 在 step 之后构造，析构时先等待任务结束
+    if (max_parallel == 0 || max_parallel >= count) {
+        for (size_t i = 0; i < count; ++i) group.Run(cls, priority, [&, i] { fn(i, executor.CurrentSlot()); });
+    } else {
+        step = [&] {
+            size_t i = next++;
+            if (i >= count) return;
+            fn(i, executor.CurrentSlot());
+            if (next < count && !group.Failed()) group.Run(cls, priority, step);
+        };
+        for (unsigned k = 0; k < max_parallel; ++k) group.Run(cls, priority, step);
+    }
+    group.Wait();
+}
+
+// 按字节数限流：超过上限时 Acquire 阻塞，直到其他任务 Release；单个超过上限的请求在空闲时仍可通过，避免死锁
+class ByteBudget {
+public:
+    explicit ByteBudget(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+    void Acquire(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [&] { return used_ == 0 || used_ + bytes <= max_bytes_; });
+        used_ += bytes;
+    }
+
+    void Release(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= bytes;
+        released_.notify_all();
+    }
+
+private:
+    size_t max_bytes_;
+    size_t used_ = 0;
+    std::mutex mutex_;
+    std::condition_variable released_;
+};
+
+// ==================== 解压算法（XPRESS / LZX，WIM分块格式） ====================
+
+// 以16位小端字为单位装载、高位优先读取的位流
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : next_(data), end_(data + size) {}
+
+    // 最多保证17位可用；输入耗尽时以0填充
+    void EnsureBits(unsigned n) {
+        if (bitsleft_ >= n) return;
+        if (end_ - next_ < 2) { bitsleft_ = 32; return; }
+        bitbuf_ |= uint32_t(GetLE16(next_)) << (16 - bitsleft_);
+        next_ += 2;
+        bitsleft_ += 16;
+        if (n == 17 && bitsleft_ == 16) {
+            if (end_ - next_ < 2) { bitsleft_ = 32; return; }
+            bitbuf_ |= uint32_t(GetLE16(next_));
+            next_ += 2;
+            bitsleft_ = 32;
+        }
+    }
+    uint32_t PeekBits(unsigned n) const { return n ? bitbuf_ >> (32 - n) : 0; }
+    void RemoveBits(unsigned n) { bitbuf_ <<= n; bitsleft_ -= n; }
+    uint32_t PopBits(unsigned n) { uint32_t v = PeekBits(n); RemoveBits(n); return v; }
+    uint32_t ReadBits(unsigned n) { EnsureBits(n); return PopBits(n); }
+
+    // 丢弃缓冲的位，此后按字节读取原始数据
+    void Align() { bitsleft_ = 0; bitbuf_ = 0; }
+    uint8_t ReadByte() { return next_ == end_ ? 0 : *next_++; }
+    uint16_t ReadU16() {
+        if (end_ - next_ < 2) { next_ = end_; return 0; }
+        uint16_t v = GetLE16(next_); next_ += 2; return v;
+    }
+    uint32_t ReadU32() {
+        if (end_ - next_ < 4) { next_ = end_; return 0; }
+        uint32_t v = GetLE32(next_); next_ += 4; return v;
+    }
+    bool ReadBytes(uint8_t* dst, size_t n) {
+        if (size_t(end_ - next_) < n) return false;
+        memcpy(dst, next_, n);
+        next_ += n;
+        return true;
+    }
+
+private:
+    uint32_t bitbuf_ = 0;
+    unsigned bitsleft_ = 0;
+    const uint8_t* next_;
+    const uint8_t* end_;
+};
+
+// 范式Huffman解码：短码查表，长码逐位回退
+class HuffmanDecoder {
+public:
+    // max_len 为格式规定的最大码长；解码前总是预读这么多位，
+    // 与未压缩块/原始字节所依赖的位流读取位置保持一致
+    bool Build(const uint8_t* lens, unsigned num_syms, unsigned max_len) {
+        count_.fill(0);
+        max_len_ = 0;
+        ensure_bits_ = max_len;
+        for (unsigned s = 0; s < num_syms; ++s) {
+            if (lens[s] > max_len) return false;
+            count_[lens[s]]++;
+            max_len_ = std::max<unsigned>(max_len_, lens[s]);
+        }
+        count_[0] = 0;
+        int left = 1;
+        for (unsigned len = 1; len <= max_len_; ++len) {
+            left = (left << 1) - count_[len];
+            if (left < 0) return false;  // 码表过满
+        }
+        std::array<uint16_t, kMaxLen + 2> offs{};
+        for (unsigned len = 1; len <= max_len_; ++len) offs[len + 1] = uint16_t(offs[len] + count_[len]);
+        symbols_.assign(num_syms, 0);
+        for (unsigned s = 0; s < num_syms; ++s) {
+            if (lens[s]) symbols_[offs[lens[s]]++] = uint16_t(s);
+        }
+        table_.assign(size_t(1) << kTableBits, 0);
+        uint32_t code = 0;
+        size_t index = 0;
+        for (unsigned len = 1; len <= max_len_; ++len) {
+            for (unsigned i = 0; i < count_[len]; ++i, ++code, ++index) {
+                if (len > kTableBits) continue;
+                uint32_t first = code << (kTableBits - len);
+                uint32_t n = 1u << (kTableBits - len);
+                std::fill(table_.begin() + first, table_.begin() + first + n,
+                          uint16_t((symbols_[index] << 5) | len));
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    int Decode(BitReader& is) const {
+        is.EnsureBits(ensure_bits_);
+        uint16_t entry = table_[is.PeekBits(kTableBits)];
+        if (entry & 31) {
+            is.RemoveBits(entry & 31);
+            return entry >> 5;
+        }
+        uint32_t peek = is.PeekBits(max_len_);
+        int code = 0, first = 0, index = 0;
+        for (unsigned len = 1; len <= max_len_; ++len) {
+            code |= (peek >> (max_len_ - len)) & 1;
+            int count = count_[len];
+            if (code - count < first) {
+                is.RemoveBits(len);
+                return symbols_[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+private:
+    static constexpr unsigned kMaxLen = 16;
+    static constexpr unsigned kTableBits = 10;
+    unsigned max_len_ = 0;
+    unsigned ensure_bits_ = 0;
+    std::array<uint16_t, kMaxLen + 1> count_{};
+    std::vector<uint16_t> symbols_;
+    std::vector<uint16_t> table_;
+};
+
+// 复制LZ77匹配（允许源和目标重叠）
+void CopyMatch(uint8_t* p, uint32_t offset, uint32_t length) {
+    const uint8_t* src = p - offset;
+    for (uint32_t i = 0; i < length; ++i) p[i] = src[i];
+}
+
+// XPRESS Huffman（LZ77+Huffman）单块解压
+bool XpressDecompress(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size) {
+    if (in_size < 256) return false;
+    uint8_t lens[512];
+    for (int i = 0; i < 256; ++i) {
+        lens[2 * i] = in[i] & 0xF;
+        lens[2 * i + 1] = in[i] >> 4;
+    }
+    HuffmanDecoder decoder;
+    if (!decoder.Build(lens, 512, 15)) return false;
+
+    BitReader is(in + 256, in_size - 256);
+    uint8_t* p = out;
+    uint8_t* const end = out + out_size;
+    while (p != end) {
+        int sym = decoder.Decode(is);
+        if (sym < 0) return false;
+        if (sym < 256) {
+            *p++ = uint8_t(sym);
+            continue;
+        }
+        uint32_t length = sym & 0xF;
+        unsigned log2_offset = (sym >> 4) & 0xF;
+        is.EnsureBits(16);
+        uint32_t offset = (1u << log2_offset) | is.PopBits(log2_offset);
+        if (length == 0xF) {
+            length += is.ReadByte();
+            if (length == 0xF + 0xFF) length = is.ReadU16();
+        }
+        length += 3;
+        if (offset > size_t(p - out) || length > size_t(end - p)) return false;
+        CopyMatch(p, offset, length);
+        p += length;
+    }
+    return true;
+}
+
+// LZX（WIM变体：每块独立解压，无E8开关位，固定E8转换文件大小12000000）
+class LzxDecompressor {
+public:
+    explicit LzxDecompressor(uint32_t chunk_size) {
+        window_order_ = 15;
+        while ((1u << window_order_) < chunk_size) ++window_order_;
+        uint32_t base = 0;
+        num_offset_slots_ = 0;
+        for (unsigned slot = 0; slot < kMaxOffsetSlots; ++slot) {
+            extra_bits_[slot] = uint8_t(slot < 4 ? 0 : std::min(17u, (slot - 2) / 2));
+            offset_base_[slot] = base;
+            if (base < (1u << window_order_)) num_offset_slots_ = slot + 1;
+            base += 1u << extra_bits_[slot];
+        }
+        num_main_syms_ = kNumChars + num_offset_slots_ * 8;
+    }
+
+    bool Decompress(const uint8_t* in, size_t in_size, uint8_t* out, size_t out_size) {
+        uint8_t main_lens[kMaxMainSyms + kLensOverrun] = {};
+        uint8_t len_lens[kNumLenSyms + kLensOverrun] = {};
+        uint32_t recent[3] = {1, 1, 1};
+        BitReader is(in, in_size);
+        uint8_t* p = out;
+        uint8_t* const end = out + out_size;
+
+        while (p != end) {
+            unsigned block_type = is.ReadBits(3);
+            uint32_t block_size;
+            if (is.ReadBits(1)) {
+                block_size = 32768;
+            } else {
+                block_size = is.ReadBits(16);
+                if (window_order_ >= 16) block_size = (block_size << 8) | is.ReadBits(8);
+            }
+            if (block_size == 0 || block_size > size_t(end - p)) return false;
+
+            if (block_type == kBlockVerbatim || block_type == kBlockAligned) {
+                uint8_t aligned_lens[8] = {};
+                if (block_type == kBlockAligned) {
+                    for (auto& len : aligned_lens) len = uint8_t(is.ReadBits(3));
+                }
+                if (!ReadLens(is, main_lens, kNumChars) ||
+                    !ReadLens(is, main_lens + kNumChars, num_main_syms_ - kNumChars) ||
+                    !ReadLens(is, len_lens, kNumLenSyms)) {
+                    return false;
+                }
+                if (!main_.Build(main_lens, num_main_syms_, 16) || !length_.Build(len_lens, kNumLenSyms, 16) ||
+                    !aligned_.Build(aligned_lens, 8, 7)) {
+                    return false;
+                }
+                if (!DecompressBlock(is, block_type, out, p, p + block_size, recent)) return false;
+                p += block_size;
+            } else if (block_type == kBlockUncompressed) {
+                // 未压缩块：先对齐到16位边界，再读取三个最近偏移
+                is.EnsureBits(1);
+                is.Align();
+                for (auto& r : recent) {
+                    r = is.ReadU32();
+                    if (r == 0) return false;
+                }
+                if (!is.ReadBytes(p, block_size)) return false;
+                p += block_size;
+                if (block_size & 1) is.ReadByte();
+            } else {
+                return false;
+            }
+        }
+        UndoE8Translation(out, out_size);
+        return true;
+    }
+
+private:
+    static constexpr unsigned kNumChars = 256;
+    static constexpr unsigned kNumLenSyms = 249;
+    static constexpr unsigned kMaxOffsetSlots = 50;
+    static constexpr unsigned kMaxMainSyms = kNumChars + kMaxOffsetSlots * 8;
+    static constexpr unsigned kLensOverrun = 50;
+    static constexpr unsigned kBlockVerbatim = 1, kBlockAligned = 2, kBlockUncompressed = 3;
+
+    // 用预编码树读取码长（相对上一块的差值编码）
+    bool ReadLens(BitReader& is, uint8_t* lens, unsigned num) {
+        uint8_t pre_lens[20];
+        for (auto& len : pre_lens) len = uint8_t(is.ReadBits(4));
+        if (!pre_.Build(pre_lens, 20, 15)) return false;
+        uint8_t* p = lens;
+        uint8_t* const end = lens + num;
+        auto delta = [](uint8_t old_len, int presym) { return uint8_t((old_len - presym + 17) % 17); };
+        while (p < end) {
+            int presym = pre_.Decode(is);
+            if (presym < 0) return false;
+            if (presym < 17) {
+                *p = delta(*p, presym);
+                ++p;
+                continue;
+            }
+            unsigned run;
+            uint8_t len = 0;
+            if (presym == 17) {
+                run = 4 + is.ReadBits(4);
+            } else if (presym == 18) {
+                run = 20 + is.ReadBits(5);
+            } else {
+                run = 4 + is.ReadBits(1);
+                int sym = pre_.Decode(is);
+                if (sym < 0 || sym > 16) return false;
+                len = delta(*p, sym);
+            }
+            while (run--) *p++ = len;  // 越界部分落在 kLensOverrun 余量内
+        }
+        return true;
+    }
+
+    bool DecompressBlock(BitReader& is, unsigned block_type, uint8_t* out_begin, uint8_t* p,
+                         uint8_t* block_end, uint32_t recent[3]) {
+        while (p != block_end) {
+            int sym = main_.Decode(is);
+            if (sym < 0) return false;
+            if (sym < int(kNumChars)) {
+                *p++ = uint8_t(sym);
+                continue;
+            }
+            sym -= kNumChars;
+            uint32_t length = sym & 7;
+            unsigned slot = unsigned(sym) >> 3;
+            if (length == 7) {
+                int extra = length_.Decode(is);
+                if (extra < 0) return false;
+                length += extra;
+            }
+            length += 2;
+
+            uint32_t offset;
+            if (slot < 3) {
+                offset = recent[slot];
+                recent[slot] = recent[0];
+            } else {
+                unsigned extra_bits = extra_bits_[slot];
+                offset = offset_base_[slot];
+                if (block_type == kBlockAligned && extra_bits >= 3) {
+                    offset += is.ReadBits(extra_bits - 3) << 3;
+                    int aligned = aligned_.Decode(is);
+                    if (aligned < 0) return false;
+                    offset += aligned;
+                } else {
+                    offset += is.ReadBits(extra_bits);
+                }
+                offset -= 2;
+                recent[2] = recent[1];
+                recent[1] = recent[0];
+            }
+            recent[0] = offset;
+            if (offset == 0 || offset > size_t(p - out_begin) || length > size_t(block_end - p)) return false;
+            CopyMatch(p, offset, length);
+            p += length;
+        }
+        return true;
+    }
+
+    static void UndoE8Translation(uint8_t* data, size_t size) {
+        const int32_t kMagicFileSize = 12000000;
+        if (size <= 10) return;
+        for (size_t i = 0; i < size - 10;) {
+            if (data[i] != 0xE8) { ++i; continue; }
+            int32_t pos = int32_t(i);
+            int32_t abs_offset = int32_t(GetLE32(data + i + 1));
+            int32_t rel_offset;
+            bool changed = false;
+            if (abs_offset >= 0) {
+                if (abs_offset < kMagicFileSize) { rel_offset = abs_offset - pos; changed = true; }
+            } else if (abs_offset >= -pos) {
+                rel_offset = abs_offset + kMagicFileSize;
+                changed = true;
+            }
+            if (changed) {
+                uint32_t v = uint32_t(rel_offset);
+                for (int b = 0; b < 4; ++b) data[i + 1 + b] = uint8_t(v >> (8 * b));
+            }
+            i += 5;
+        }
+    }
+
+    unsigned window_order_;
+    unsigned num_offset_slots_;
+    unsigned num_main_syms_;
+    uint8_t extra_bits_[kMaxOffsetSlots];
+    uint32_t offset_base_[kMaxOffsetSlots];
+    HuffmanDecoder pre_, main_, length_, aligned_;
+};
+
+// ==================== WIM 解析 ====================
+
+const uint32_t kWimHeaderSize = 208;
+const uint32_t kWimLookupEntrySize = 50;
+
+// 头部标志
+const uint32_t kWimFlagCompression = 0x00000002;
+const uint32_t kWimFlagSpanned = 0x00000008;
+const uint32_t kWimFlagXpress = 0x00020000;
+const uint32_t kWimFlagLzx = 0x00040000;
+const uint32_t kWimFlagLzms = 0x00080000;
+
+// 资源标志
+const uint8_t kResFlagMetadata = 0x02;
+const uint8_t kResFlagCompressed = 0x04;
+const uint8_t kResFlagSolid = 0x10;
+
+const uint32_t kAttrReadonly = 0x01, kAttrHidden = 0x02, kAttrSystem = 0x04;
+const uint32_t kAttrDirectory = 0x10, kAttrArchive = 0x20, kAttrReparsePoint = 0x400;
+
+// 资源头（RESHDR_DISK_SHORT）
+struct WimResHdr {
+    uint64_t size_in_wim = 0;
+    uint8_t flags = 0;
+    uint64_t offset = 0;
+    uint64_t original_size = 0;
+};
+
+WimResHdr ParseResHdr(const uint8_t* p) {
+    WimResHdr res;
+    res.size_in_wim = GetLE64(p) & 0x00FFFFFFFFFFFFFFull;
+    res.flags = p[7];
+    res.offset = GetLE64(p + 8);
+    res.original_size = GetLE64(p + 16);
+    return res;
+}
+
+void WriteResHdr(uint8_t* p, const WimResHdr& res) {
+    PutLE64(p, (res.size_in_wim & 0x00FFFFFFFFFFFFFFull) | (uint64_t(res.flags) << 56));
+    PutLE64(p + 8, res.offset);
+    PutLE64(p + 16, res.original_size);
+}
+
+struct WimHeader {
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    uint32_t chunk_size = 0;
+    std::array<uint8_t, 16> guid{};
+    uint16_t part_number = 1;
+    uint16_t total_parts = 1;
+    uint32_t image_count = 0;
+    WimResHdr lookup_table;
+    WimResHdr xml_data;
+    WimResHdr boot_metadata;
+    uint32_t boot_index = 0;
+    WimResHdr integrity;
+};
+
+std::array<uint8_t, kWimHeaderSize> SerializeWimHeader(const WimHeader& h) {
+    std::array<uint8_t, kWimHeaderSize> buf{};
+    memcpy(buf.data(), "MSWIM\0\0\0", 8);
+    PutLE32(buf.data() + 8, kWimHeaderSize);
+    PutLE32(buf.data() + 12, h.version);
+    PutLE32(buf.data() + 16, h.flags);
+    PutLE32(buf.data() + 20, (h.flags & kWimFlagCompression) ? h.chunk_size : 0);
+    memcpy(buf.data() + 24, h.guid.data(), 16);
+    PutLE16(buf.data() + 40, h.part_number);
+    PutLE16(buf.data() + 42, h.total_parts);
+    PutLE32(buf.data() + 44, h.image_count);
+    WriteResHdr(buf.data() + 48, h.lookup_table);
+    WriteResHdr(buf.data() + 72, h.xml_data);
+    WriteResHdr(buf.data() + 96, h.boot_metadata);
+    PutLE32(buf.data() + 120, h.boot_index);
+    WriteResHdr(buf.data() + 124, h.integrity);
+    return buf;
+}
+
+// 查找表项：一个按SHA-1单实例存储的数据流
+struct WimBlob {
+    WimResHdr res;
+    uint16_t part_number = 1;
+    uint32_t ref_count = 0;
+    Sha1Hash hash{};
+};
+
+void WriteLookupEntry(uint8_t* p, const WimBlob& blob) {
+    WriteResHdr(p, blob.res);
+    PutLE16(p + 24, blob.part_number);
+    PutLE32(p + 26, blob.ref_count);
+    memcpy(p + 30, blob.hash.data(), 20);
+}
+
+// 镜像内的一个文件或目录
+struct WimDentry {
+    fs::path path;  // 相对镜像根目录
+    uint32_t attributes = 0;
+    uint64_t creation_time = 0;
+    uint64_t last_access_time = 0;
+    uint64_t last_write_time = 0;
+    uint64_t hard_link_group = 0;
+    Sha1Hash hash{};  // 未命名数据流
+    std::vector<Sha1Hash> named_streams;  // 命名数据流（释放时忽略，导出镜像时需要）
+
+    bool IsDirectory() const { return (attributes & kAttrDirectory) != 0; }
+    bool IsReparsePoint() const { return (attributes & kAttrReparsePoint) != 0; }
+};
+
+class WimReader {
+public:
+    explicit WimReader(const fs::path& path) : path_(path) {
+        std::ifstream in = Open();
+        uint8_t buf[kWimHeaderSize];
+        ReadAt(in, 0, buf, sizeof(buf));
+        if (memcmp(buf, "MSWIM\0\0\0", 8) != 0) throw std::runtime_error("not a WIM file: " + path.string());
+        header_.version = GetLE32(buf + 12);
+        header_.flags = GetLE32(buf + 16);
+        header_.chunk_size = GetLE32(buf + 20);
+        if (header_.chunk_size == 0) header_.chunk_size = 32768;
+        memcpy(header_.guid.data(), buf + 24, 16);
+        header_.part_number = GetLE16(buf + 40);
+        header_.total_parts = GetLE16(buf + 42);
+        header_.image_count = GetLE32(buf + 44);
+        header_.lookup_table = ParseResHdr(buf + 48);
+        header_.xml_data = ParseResHdr(buf + 72);
+        header_.boot_metadata = ParseResHdr(buf + 96);
+        header_.boot_index = GetLE32(buf + 120);
+        header_.integrity = ParseResHdr(buf + 124);
+
+        if (header_.flags & kWimFlagCompression) {
+            if (header_.flags & kWimFlagLzms) throw std::runtime_error("LZMS compression is not supported");
+            if (!(header_.flags & (kWimFlagXpress | kWimFlagLzx))) throw std::runtime_error("unknown WIM compression");
+            if (header_.chunk_size > (1u << 21) || (header_.chunk_size & (header_.chunk_size - 1)))
+                throw std::runtime_error("unsupported WIM chunk size");
+        }
+
+        std::vector<uint8_t> table = ReadResource(in, header_.lookup_table);
+        table_hash_ = ComputeSha1(table.data(), table.size());
+        for (size_t off = 0; off + kWimLookupEntrySize <= table.size(); off += kWimLookupEntrySize) {
+            const uint8_t* p = table.data() + off;
+            WimBlob blob;
+            blob.res = ParseResHdr(p);
+            blob.part_number = GetLE16(p + 24);
+            blob.ref_count = GetLE32(p + 26);
+            memcpy(blob.hash.data(), p + 30, 20);
+            if (blob.res.flags & kResFlagMetadata) {
+                metadata_.push_back(blob);
+            } else {
+                blob_index_[blob.hash] = blobs_.size();
+                blobs_.push_back(blob);
+            }
+        }
+    }
+
+    const fs::path& Path() const { return path_; }
+    const WimHeader& Header() const { return header_; }
+    const std::vector<WimBlob>& Blobs() const { return blobs_; }
+    const std::vector<WimBlob>& Metadata() const { return metadata_; }
+    // 查找表的SHA-1。表中列出了全部资源的SHA-1，固定这个值即固定了镜像中的全部内容
+    const Sha1Hash& LookupTableHash() const { return table_hash_; }
+
+    const WimBlob* FindBlob(const Sha1Hash& hash) const {
+        auto it = blob_index_.find(hash);
+        return it == blob_index_.end() ? nullptr : &blobs_[it->second];
+    }
+
+    // 每个线程各自持有一个文件句柄，避免共享seek位置
+    std::ifstream Open() const {
+        std::ifstream in(path_, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open " + path_.string());
+        return in;
+    }
+
+    static void ReadAt(std::ifstream& in, uint64_t offset, void* buf, size_t size) {
+        in.clear();
+        in.seekg(std::streamoff(offset));
+        in.read(static_cast<char*>(buf), std::streamsize(size));
+        if (size_t(in.gcount()) != size) throw std::runtime_error("unexpected end of WIM file");
+    }
+
+    // 不解压，原样读出资源在文件中的字节
+    static void CopyRaw(std::ifstream& in, uint64_t offset, uint64_t size,
+                        const std::function<void(const uint8_t*, size_t)>& sink) {
+        std::vector<uint8_t> buf(size_t(std::min<uint64_t>(size, 4 << 20)));
+        for (uint64_t done = 0; done < size;) {
+            size_t n = size_t(std::min<uint64_t>(buf.size(), size - done));
+            ReadAt(in, offset + done, buf.data(), n);
+            sink(buf.data(), n);
+            done += n;
+        }
+    }
+
+    // 按顺序把资源的解压内容交给 sink
+    void ReadResource(std::ifstream& in, const WimResHdr& res,
+                      const std::function<void(const uint8_t*, size_t)>& sink) const {
+        if (res.flags & kResFlagSolid) throw std::runtime_error("solid WIM resources are not supported");
+        if (!(res.flags & kResFlagCompressed)) {
+            if (res.size_in_wim != res.original_size) throw std::runtime_error("bad uncompressed resource size");
+            CopyRaw(in, res.offset, res.size_in_wim, sink);
+            return;
+        }
+
+        const uint32_t chunk_size = header_.chunk_size;
+        const uint64_t num_chunks = (res.original_size + chunk_size - 1) / chunk_size;
+        if (num_chunks == 0) return;
+        const size_t entry_size = res.original_size > 0xFFFFFFFFull ? 8 : 4;
+        const uint64_t table_size = (num_chunks - 1) * entry_size;
+        if (table_size > res.size_in_wim) throw std::runtime_error("corrupt chunk table");
+        std::vector<uint8_t> table(static_cast<size_t>(table_size));
+        if (table_size) ReadAt(in, res.offset, table.data(), table.size());
+        std::vector<uint64_t> offsets(size_t(num_chunks + 1), 0);
+        for (uint64_t i = 1; i < num_chunks; ++i) {
+            const uint8_t* p = table.data() + (i - 1) * entry_size;
+            offsets[i] = entry_size == 8 ? GetLE64(p) : GetLE32(p);
+        }
+        offsets[num_chunks] = res.size_in_wim - table_size;
+
+        std::unique_ptr<LzxDecompressor> lzx;
+        if (header_.flags & kWimFlagLzx) lzx = std::make_unique<LzxDecompressor>(chunk_size);
+        std::vector<uint8_t> packed, chunk(chunk_size);
+        const uint64_t data_start = res.offset + table_size;
+        // 一次读入若干个块，减少小块seek
+        const uint64_t kBatchBytes = 8u << 20;
+        for (uint64_t first = 0; first < num_chunks;) {
+            uint64_t last = first + 1;
+            while (last < num_chunks && offsets[last + 1] - offsets[first] <= kBatchBytes) ++last;
+            if (offsets[last] < offsets[first]) throw std::runtime_error("corrupt chunk table");
+            packed.resize(size_t(offsets[last] - offsets[first]));
+            ReadAt(in, data_start + offsets[first], packed.data(), packed.size());
+            for (uint64_t i = first; i < last; ++i) {
+                if (offsets[i + 1] < offsets[i]) throw std::runtime_error("corrupt chunk table");
+                const uint8_t* src = packed.data() + (offsets[i] - offsets[first]);
+                size_t src_size = size_t(offsets[i + 1] - offsets[i]);
+                size_t out_size = size_t(std::min<uint64_t>(chunk_size, res.original_size - i * chunk_size));
+                if (src_size == out_size) {
+                    sink(src, out_size);
+                    continue;
+                }
+                bool ok = src_size < out_size &&
+                          (lzx ? lzx->Decompress(src, src_size, chunk.data(), out_size)
+                               : XpressDecompress(src, src_size, chunk.data(), out_size));
+                if (!ok) throw std::runtime_error("corrupt compressed chunk in " + path_.string());
+                sink(chunk.data(), out_size);
+            }
+            first = last;
+        }
+    }
+
+    std::vector<uint8_t> ReadResource(std::ifstream& in, const WimResHdr& res) const {
+        std::vector<uint8_t> data;
+        data.reserve(size_t(res.original_size));
+        ReadResource(in, res, [&](const uint8_t* p, size_t n) { data.insert(data.end(), p, p + n); });
+        return data;
+    }
+
+    // 读取第 index 个镜像（从1开始）的目录树
+    std::vector<WimDentry> ReadImage(std::ifstream& in, uint32_t index) const {
+        if (index < 1 || index > metadata_.size()) throw std::runtime_error("image index out of range");
+        std::vector<uint8_t> meta = ReadResource(in, metadata_[index - 1].res);
+        if (meta.size() < 8) throw std::runtime_error("metadata resource too small");
+        uint64_t security_size = std::max<uint64_t>(GetLE32(meta.data()), 8);
+        uint64_t root_offset = (security_size + 7) & ~7ull;
+
+        std::vector<WimDentry> entries;
+        WimDentry root;
+        uint64_t subdir = 0, next = 0;
+        if (!ParseDentry(meta, root_offset, root, subdir, next)) throw std::runtime_error("missing root dentry");
+        ParseDirectory(meta, subdir, fs::path(), entries, 0);
+        return entries;
+    }
+
+private:
+    static bool ParseDentry(const std::vector<uint8_t>& meta, uint64_t offset, WimDentry& d,
+                            uint64_t& subdir, uint64_t& next) {
+        if (offset + 8 > meta.size()) throw std::runtime_error("corrupt dentry offset");
+        const uint8_t* p = meta.data() + offset;
+        uint64_t length = GetLE64(p);
+        if (length <= 8) return false;  // 目录结束标记
+        if (length < 102 || offset + length > meta.size()) throw std::runtime_error("corrupt dentry");
+
+        d.attributes = GetLE32(p + 8);
+        subdir = GetLE64(p + 16);
+        d.creation_time = GetLE64(p + 40);
+        d.last_access_time = GetLE64(p + 48);
+        d.last_write_time = GetLE64(p + 56);
+        memcpy(d.hash.data(), p + 64, 20);
+        d.hard_link_group = d.IsReparsePoint() ? 0 : GetLE64(p + 88);
+        uint16_t num_streams = GetLE16(p + 96);
+        uint16_t name_bytes = GetLE16(p + 100);
+        if (102ull + name_bytes > length) throw std::runtime_error("corrupt dentry name");
+        std::u16string name(name_bytes / 2, u'\0');
+        for (size_t i = 0; i < name.size(); ++i) name[i] = char16_t(GetLE16(p + 102 + i * 2));
+        d.path = fs::path(name);
+
+        next = offset + ((length + 7) & ~7ull);
+        for (uint16_t i = 0; i < num_streams; ++i) {
+            if (next + 38 > meta.size()) throw std::runtime_error("corrupt stream entry");
+            const uint8_t* s = meta.data() + next;
+            uint64_t stream_length = GetLE64(s);
+            if (stream_length < 38 || next + stream_length > meta.size()) throw std::runtime_error("corrupt stream entry");
+            Sha1Hash stream_hash;
+            memcpy(stream_hash.data(), s + 16, 20);
+            if (!IsZeroHash(stream_hash)) {
+                if (GetLE16(s + 36) == 0) d.hash = stream_hash;
+                else d.named_streams.push_back(stream_hash);
+            }
+            next += (stream_length + 7) & ~7ull;
+        }
+        return true;
+    }
+
+    static void ParseDirectory(const std::vector<uint8_t>& meta, uint64_t offset, const fs::path& parent,
+                               std::vector<WimDentry>& entries, int depth) {
+        if (offset == 0) return;
+        if (depth > 256) throw std::runtime_error("WIM directory tree too deep");
+        for (;;) {
+            WimDentry d;
+            uint64_t subdir = 0, next = 0;
+            if (!ParseDentry(meta, offset, d, subdir, next)) break;
+            // 拒绝可能逃逸出目标目录的名字
+            std::u16string name = d.path.u16string();
+            if (name.empty() || name == u"." || name == u".." || name.find_first_of(u"/\\:") != std::u16string::npos)
+                throw std::runtime_error("invalid file name in WIM");
+            d.path = parent / d.path;
+            entries.push_back(d);
+            if (d.IsDirectory() && !d.IsReparsePoint()) ParseDirectory(meta, subdir, d.path, entries, depth + 1);
+            offset = next;
+            if (entries.size() > 10000000) throw std::runtime_error("too many WIM entries");
+        }
+    }
+
+    fs::path path_;
+    WimHeader header_;
+    std::vector<WimBlob> blobs_;
+    std::vector<WimBlob> metadata_;
+    std::map<Sha1Hash, size_t> blob_index_;
+    Sha1Hash table_hash_{};
+};
+
+// ==================== WIM 释放 ====================
+
+// 写入单个文件并恢复时间戳与属性
+void WriteExtractedFile(const fs::path& path, const std::vector<uint8_t>& data, const WimDentry& d) {
+#ifdef _WIN32
+    DWORD old_attrs = GetFileAttributesW(path.c_str());
+    if (old_attrs != INVALID_FILE_ATTRIBUTES) SetFileAttributesW(path.c_str(), FILE_ATTRIBUTE_NORMAL);
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot create " + path.string());
+    size_t done = 0;
+    while (done < data.size()) {
+        DWORD n = DWORD(std::min<size_t>(data.size() - done, 1u << 30));
+        DWORD written = 0;
+        if (!WriteFile(h, data.data() + done, n, &written, nullptr) || written == 0) {
+            CloseHandle(h);
+            throw std::runtime_error("write failed: " + path.string());
+        }
+        done += written;
+    }
+    auto to_filetime = [](uint64_t t) { FILETIME ft; ft.dwLowDateTime = DWORD(t); ft.dwHighDateTime = DWORD(t >> 32); return ft; };
+    FILETIME c = to_filetime(d.creation_time), a = to_filetime(d.last_access_time), w = to_filetime(d.last_write_time);
+    SetFileTime(h, &c, &a, &w);
+    CloseHandle(h);
+    DWORD attrs = d.attributes & (kAttrReadonly | kAttrHidden | kAttrSystem | kAttrArchive);
+    if (attrs) SetFileAttributesW(path.c_str(), attrs);
+#else
+    (void)d;
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(data.data()), std::streamsize(data.size()));
+    if (!out) throw std::runtime_error("write failed: " + path.string());
+#endif
+}
+
+struct WimApplyStats {
+    size_t directories = 0;
+    size_t files = 0;
+    size_t decoded_blobs = 0;
+    size_t hard_links = 0;
+    size_t skipped_reparse = 0;
+    uint64_t bytes = 0;
+};
+
+// 原生释放镜像：按资源在文件中的顺序并行解压（同一数据流只解码一次），
+// 写文件交给执行器的I/O线程；硬链接组用 create_hard_link 还原
+WimApplyStats ApplyWimImage(const WimReader& wim, uint32_t index, const fs::path& target) {
+    const size_t kQueueBytes = size_t(256) << 20;
+
+    WimApplyStats stats;
+    std::vector<WimDentry> entries;
+    {
+        std::ifstream in = wim.Open();
+        entries = wim.ReadImage(in, index);
+    }
+
+    // 先建目录，再按数据流分组
+    fs::create_directories(target);
+    std::map<Sha1Hash, std::vector<const WimDentry*>> groups;
+    for (const auto& d : entries) {
+        if (d.IsReparsePoint()) {
+            stats.skipped_reparse++;
+        } else if (d.IsDirectory()) {
+            fs::create_directories(target / d.path);
+            stats.directories++;
+        } else {
+            groups[d.hash].push_back(&d);
+        }
+    }
+
+    struct Job {
+        const WimBlob* blob;
+        std::vector<const WimDentry*> targets;
+    };
+    std::vector<Job> jobs;
+    for (auto& [hash, targets] : groups) {
+        const WimBlob* blob = IsZeroHash(hash) ? nullptr : wim.FindBlob(hash);
+        if (!IsZeroHash(hash) && !blob) throw std::runtime_error("missing resource " + HashToHex(hash));
+        jobs.push_back({blob, std::move(targets)});
+    }
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        return (a.blob ? a.blob->res.offset : 0) < (b.blob ? b.blob->res.offset : 0);
+    });
+
+    // 解压在CPU线程上并行，写文件作为高优先级I/O任务提交，已解压未写出的数据不超过 kQueueBytes
+    struct WriteItem {
+        WriteItem(ByteBudget& budget, std::vector<uint8_t> bytes) : budget(budget), data(std::move(bytes)) {}
+        ~WriteItem() { budget.Release(data.size()); }  // 任务被跳过时同样归还额度
+        ByteBudget& budget;
+        std::vector<uint8_t> data;
+    };
+    ByteBudget budget(kQueueBytes);
+    std::mutex stats_mutex;
+    Executor& executor = Executor::Instance();
+    std::vector<std::ifstream> handles(executor.SlotCount());
+
+    auto write = [&](const WriteItem& item, const std::vector<const WimDentry*>& targets) {
+        std::map<uint64_t, fs::path> link_sources;
+        size_t links = 0;
+        for (const WimDentry* d : targets) {
+            fs::path path = target / d->path;
+            if (d->hard_link_group != 0) {
+                auto it = link_sources.find(d->hard_link_group);
+                if (it != link_sources.end()) {
+                    std::error_code ec;
+                    fs::remove(path, ec);
+                    fs::create_hard_link(it->second, path, ec);
+                    if (!ec) { ++links; continue; }
+                }
+                link_sources.emplace(d->hard_link_group, path);
+            }
+            // 单实例但非硬链接的重复文件直接复用已解码的数据
+            WriteExtractedFile(path, item.data, *d);
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats.files += targets.size();
+        stats.hard_links += links;
+        stats.bytes += uint64_t(item.data.size()) * (targets.size() - links);
+    };
+
+    TaskGroup group(executor);
+    for (const Job& job : jobs) {
+        group.Run(TaskClass::Cpu, TaskPriority::Normal, [&, job = &job] {
+            std::vector<uint8_t> data;
+            if (job->blob) {
+                std::ifstream& in = handles[executor.CurrentSlot()];
+                if (!in.is_open()) in.open(wim.Path(), std::ios::binary);
+                data = wim.ReadResource(in, job->blob->res);
+                if (ComputeSha1(data.data(), data.size()) != job->blob->hash)
+                    throw std::runtime_error("SHA-1 mismatch for " + job->targets.front()->path.string());
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                stats.decoded_blobs++;
+            }
+            budget.Acquire(data.size());
+            auto item = std::make_shared<WriteItem>(budget, std::move(data));
+            group.Run(TaskClass::Io, TaskPriority::High, [&, item, job] { write(*item, job->targets); });
+        });
+    }
+    group.Wait();
+
+#ifdef _WIN32
+    for (const auto& d : entries) {
+        DWORD attrs = d.attributes & (kAttrHidden | kAttrSystem | kAttrReadonly);
+        if (d.IsDirectory() && attrs) SetFileAttributesW((target / d.path).c_str(), attrs | FILE_ATTRIBUTE_DIRECTORY);
+    }
+#endif
+    return stats;
+}
+
+// ==================== 写后校验 ====================
+
+// 与WIM完整性表的默认分块大小一致
+const uint32_t kVerifyChunkSize = 10 << 20;
+
+// 已写到目标盘的文件，以及写入时记录的分块哈希
+struct StagedFile {
+    fs::path path;
+    uint64_t size = 0;
+    uint32_t chunk_size = kVerifyChunkSize;
+    std::vector<Sha1Hash> chunks;  // 为空时改用文件自带的WIM完整性表
+};
+
+// 边写边按块计算SHA-1
+class ChunkHashRecorder {
+public:
+    void Update(const uint8_t* p, size_t n) {
+        while (n > 0) {
+            size_t take = std::min<size_t>(n, kVerifyChunkSize - filled_);
+            sha_.Update(p, take);
+            filled_ += take;
+            total_ += take;
+            p += take;
+            n -= take;
+            if (filled_ == kVerifyChunkSize) {
+                chunks_.push_back(sha_.Final());
+                sha_.Reset();
+                filled_ = 0;
+            }
+        }
+    }
+
+    StagedFile Finish(const fs::path& path) {
+        if (filled_ > 0) chunks_.push_back(sha_.Final());
+        StagedFile file;
+        file.path = path;
+        file.size = total_;
+        file.chunks = std::move(chunks_);
+        sha_.Reset();
+        chunks_.clear();
+        filled_ = 0;
+        total_ = 0;
+        return file;
+    }
+
+private:
+    Sha1 sha_;
+    std::vector<Sha1Hash> chunks_;
+    size_t filled_ = 0;
+    uint64_t total_ = 0;
+};
+
+// \\.\X: 形式的路径表示卷设备
+bool IsDevicePath(const fs::path& path) {
+    return path.string().compare(0, 4, "\\\\.\\") == 0;
+}
+
+// PE分区对应的卷设备，例如 B:\ 对应 \\.\B:；PE分区根目录不是盘符时为空
+std::string PeVolumeDevice() {
+    std::string root = PeRoot().string();
+    if (root.size() < 2 || root[1] != ':' || !isalpha(uint8_t(root[0]))) return std::string();
+    return "\\\\.\\" + root.substr(0, 2);
+}
+
+// 把文件在系统缓存中的脏数据刷到盘上
+void FlushFileToDisk(const fs::path& path) {
+#ifdef _WIN32
+    HANDLE h = CreateFileW(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open " + path.string());
+    BOOL ok = FlushFileBuffers(h);
+    CloseHandle(h);
+    if (!ok) throw std::runtime_error("flush failed: " + path.string());
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + path.string());
+    int rc = fsync(fd);
+    close(fd);
+    if (rc != 0) throw std::runtime_error("flush failed: " + path.string());
+#endif
+}
+
+// 绕过系统缓存读文件，保证校验的是盘上的真实数据
+class UncachedReader {
+public:
+    static const size_t kAlign = 4096;
+
+    explicit UncachedReader(const fs::path& path) {
+#ifdef _WIN32
+        // 卷设备同时被文件系统以写方式打开，需要允许共享写
+        handle_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (handle_ == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open " + path.string());
+#else
+        fd_ = open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) throw std::runtime_error("cannot open " + path.string());
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    }
+    ~UncachedReader() {
+#ifdef _WIN32
+        CloseHandle(handle_);
+#else
+        close(fd_);
+#endif
+    }
+    UncachedReader(const UncachedReader&) = delete;
+    UncachedReader& operator=(const UncachedReader&) = delete;
+
+    // offset 必须按 kAlign 对齐，buf 需按 kAlign 对齐且容量可容纳向上取整后的 size；返回实际读到的字节数
+    size_t Read(uint64_t offset, uint8_t* buf, size_t size) {
+#ifdef _WIN32
+        size_t done = 0;
+        const size_t aligned = (size + kAlign - 1) & ~(kAlign - 1);
+        while (done < aligned) {
+            OVERLAPPED ov{};
+            ov.Offset = DWORD(offset + done);
+            ov.OffsetHigh = DWORD((offset + done) >> 32);
+            DWORD got = 0;
+            DWORD want = DWORD(std::min<size_t>(aligned - done, 1u << 30));
+            if (!ReadFile(handle_, buf + done, want, &got, &ov)) {
+                if (GetLastError() == ERROR_HANDLE_EOF) break;
+                throw std::runtime_error("read failed");
+            }
+            if (got == 0) break;
+            done += got;
+        }
+        return std::min(done, size);
+#else
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd_, buf + done, size - done, off_t(offset + done));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) throw std::runtime_error("read failed");
+            if (n == 0) break;
+            done += size_t(n);
+        }
+        return done;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle_;
+#else
+    int fd_;
+#endif
+};
+
+struct ChunkCheck {
+    const fs::path* path;
+    uint64_t offset;
+    uint64_t length;
+    Sha1Hash expected;
+};
+
+// 并行回读所有分块并比对哈希，返回校验失败的文件。
+// 回读在I/O线程上进行，读到的分块交给CPU线程计算哈希；已读出未哈希的数据不超过 kQueueBytes
+std::vector<fs::path> VerifyChunks(const std::vector<ChunkCheck>& checks) {
+    const size_t kAlign = UncachedReader::kAlign;
+    const size_t kQueueBytes = size_t(128) << 20;
+    std::mutex bad_mutex;
+    std::vector<fs::path> bad;
+    auto mark_bad = [&](const fs::path& path) {
+        std::lock_guard<std::mutex> lock(bad_mutex);
+        if (std::find(bad.begin(), bad.end(), path) == bad.end()) bad.push_back(path);
+    };
+
+    struct ReadItem {
+        ReadItem(ByteBudget& budget, size_t size) : budget(budget), storage(size) {}
+        ~ReadItem() { budget.Release(storage.size()); }  // 任务被跳过时同样归还额度
+        ByteBudget& budget;
+        std::vector<uint8_t> storage;
+        const uint8_t* data = nullptr;
+    };
+    ByteBudget budget(kQueueBytes);
+    TaskGroup group(Executor::Instance());
+    for (const ChunkCheck& check : checks) {
+        group.Run(TaskClass::Io, TaskPriority::Normal, [&, check = &check] {
+            // 无缓冲读要求偏移、长度和缓冲区都按扇区对齐，多读的部分不参与哈希
+            uint64_t aligned_offset = check->offset & ~uint64_t(kAlign - 1);
+            size_t head = size_t(check->offset - aligned_offset);
+            size_t want = head + size_t(check->length);
+            budget.Acquire(want + 2 * kAlign);
+            auto item = std::make_shared<ReadItem>(budget, want + 2 * kAlign);
+            uint8_t* buf = reinterpret_cast<uint8_t*>(
+                (reinterpret_cast<uintptr_t>(item->storage.data()) + kAlign - 1) & ~uintptr_t(kAlign - 1));
+            bool ok = false;
+            try {
+                UncachedReader reader(*check->path);
+                ok = reader.Read(aligned_offset, buf, want) == want;
+            } catch (const std::exception&) {
+                ok = false;
+            }
+            if (!ok) {
+                mark_bad(*check->path);
+                return;
+            }
+            item->data = buf + head;
+            group.Run(TaskClass::Cpu, TaskPriority::High, [&, item, check] {
+                if (ComputeSha1(item->data, size_t(check->length)) != check->expected) mark_bad(*check->path);
+            });
+        });
+    }
+    group.Wait();
+    return bad;
+}
+
+// 读取WIM自带的完整性表，它覆盖从头部之后到查找表末尾的区域
+bool AddWimIntegrityChecks(const fs::path& path, std::vector<ChunkCheck>& checks) {
+    WimReader wim(path);
+    const WimHeader& h = wim.Header();
+    if (h.integrity.offset == 0 || h.integrity.original_size < 12) return false;
+    std::ifstream in = wim.Open();
+    std::vector<uint8_t> table = wim.ReadResource(in, h.integrity);
+    uint32_t num_entries = GetLE32(table.data() + 4);
+    uint32_t chunk_size = GetLE32(table.data() + 8);
+    uint64_t start = kWimHeaderSize;
+    uint64_t end = h.lookup_table.offset + h.lookup_table.size_in_wim;
+    if (chunk_size == 0 || end < start || 12 + uint64_t(num_entries) * 20 > table.size() ||
+        num_entries != (end - start + chunk_size - 1) / chunk_size)
+        throw std::runtime_error("corrupt integrity table in " + path.string());
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        ChunkCheck check;
+        check.path = &path;
+        check.offset = start + uint64_t(i) * chunk_size;
+        check.length = std::min<uint64_t>(chunk_size, end - check.offset);
+        memcpy(check.expected.data(), table.data() + 12 + i * 20, 20);
+        checks.push_back(check);
+    }
+    return true;
+}
+
+// 写后校验：优先比对写入时记录的分块哈希，没有记录时使用WIM完整性表
+std::vector<fs::path> VerifyStagedFiles(const std::vector<StagedFile>& files) {
+    std::vector<ChunkCheck> checks;
+    std::vector<fs::path> bad;
+    for (const auto& file : files) {
+        // 卷设备（\\.\B:）在写入时已刷盘，也没有文件大小，只按记录的范围回读
+        const bool device = IsDevicePath(file.path);
+        if (!device) FlushFileToDisk(file.path);
+        if (file.chunks.empty()) {
+            if (!AddWimIntegrityChecks(file.path, checks))
+                std::cout << "[WARN] " << file.path.filename().string() << " 没有可用的校验信息，跳过校验" << std::endl;
+            continue;
+        }
+        if (!device && fs::file_size(file.path) != file.size) {
+            bad.push_back(file.path);
+            continue;
+        }
+        for (size_t i = 0; i < file.chunks.size(); ++i) {
+            uint64_t offset = uint64_t(i) * file.chunk_size;
+            checks.push_back({&file.path, offset, std::min<uint64_t>(file.chunk_size, file.size - offset), file.chunks[i]});
+        }
+    }
+    for (auto& path : VerifyChunks(checks)) bad.push_back(path);
+    return bad;
+}
+
+// 复制文件并记录分块哈希。读写只在调用线程上按顺序进行，目标文件始终顺序写出；
+// 每读满一个校验分块就交给CPU线程计算哈希，与后续读写重叠，在途分块不超过 kHashQueueBytes
+StagedFile CopyFileRecorded(const fs::path& source, const fs::path& target) {
+    const size_t kHashQueueBytes = size_t(4) * kVerifyChunkSize;
+    std::ifstream in(source, std::ios::binary);
+    if (!in) throw std::runtime_error("cannot open " + source.string());
+    std::ofstream out(target, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("cannot create " + target.string());
+
+    StagedFile file;
+    file.path = target;
+    file.size = fs::file_size(source);
+    file.chunks.resize(size_t((file.size + kVerifyChunkSize - 1) / kVerifyChunkSize));
+
+    struct Block {
+        Block(ByteBudget& budget, size_t size) : budget(budget), data(size) {}
+        ~Block() { budget.Release(data.size()); }
+        ByteBudget& budget;
+        std::vector<uint8_t> data;
+    };
+    ByteBudget budget(kHashQueueBytes);
+    TaskGroup group;
+    uint64_t copied = 0;
+    for (size_t i = 0; i < file.chunks.size(); ++i) {
+        size_t n = size_t(std::min<uint64_t>(kVerifyChunkSize, file.size - copied));
+        budget.Acquire(n);
+        auto block = std::make_shared<Block>(budget, n);
+        in.read(reinterpret_cast<char*>(block->data.data()), std::streamsize(n));
+        if (size_t(in.gcount()) != n) throw std::runtime_error("copy failed: " + source.string());
+        group.Run(TaskClass::Cpu, TaskPriority::Normal, [&file, block, i] {
+            file.chunks[i] = ComputeSha1(block->data.data(), block->data.size());
+        });
+        out.write(reinterpret_cast<const char*>(block->data.data()), std::streamsize(n));
+        if (!out) throw std::runtime_error("copy failed: " + target.string());
+        copied += n;
+    }
+    group.Wait();
+    out.close();
+    if (!out) throw std::runtime_error("copy failed: " + target.string());
+    return file;
+}
+
+// 并行计算已有文件的分块哈希，分块方式与 ChunkHashRecorder 相同
+StagedFile HashFileChunks(const fs::path& path) {
+    StagedFile file;
+    file.path = path;
+    file.size = fs::file_size(path);
+    file.chunks.resize(size_t((file.size + kVerifyChunkSize - 1) / kVerifyChunkSize));
+    const unsigned slots = Executor::Instance().SlotCount();
+    std::vector<std::ifstream> handles(slots);
+    std::vector<std::vector<uint8_t>> buffers(slots);
+    ParallelFor(file.chunks.size(), TaskClass::Io, [&](size_t i, unsigned worker) {
+        if (!handles[worker].is_open()) handles[worker].open(path, std::ios::binary);
+        uint64_t offset = uint64_t(i) * kVerifyChunkSize;
+        auto& buf = buffers[worker];
+        buf.resize(size_t(std::min<uint64_t>(kVerifyChunkSize, file.size - offset)));
+        WimReader::ReadAt(handles[worker], offset, buf.data(), buf.size());
+        file.chunks[i] = ComputeSha1(buf.data(), buf.size());
+    });
+    return file;
+}
+
+// 并行计算一组文件的分块哈希，每个文件在一个线程上顺序读取；用于释放出的大量小文件
+std::vector<StagedFile> HashFiles(const std::vector<fs::path>& paths) {
+    std::vector<StagedFile> files(paths.size());
+    std::vector<std::vector<uint8_t>> buffers(Executor::Instance().SlotCount());
+    ParallelFor(paths.size(), TaskClass::Io, [&](size_t i, unsigned worker) {
+        std::ifstream in(paths[i], std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open " + paths[i].string());
+        auto& buf = buffers[worker];
+        buf.resize(1 << 20);
+        ChunkHashRecorder recorder;
+        while (in) {
+            in.read(reinterpret_cast<char*>(buf.data()), std::streamsize(buf.size()));
+            recorder.Update(buf.data(), size_t(in.gcount()));
+        }
+        files[i] = recorder.Finish(paths[i]);
+    });
+    return files;
+}
+
+// 并行复制一组文件并记录分块哈希，每个文件在一个线程上顺序读写；用于大量小文件
+std::vector<StagedFile> CopyFiles(const std::vector<std::pair<fs::path, fs::path>>& pairs) {
+    std::vector<StagedFile> files(pairs.size());
+    std::vector<std::vector<uint8_t>> buffers(Executor::Instance().SlotCount());
+    ParallelFor(pairs.size(), TaskClass::Io, [&](size_t i, unsigned worker) {
+        const auto& [source, target] = pairs[i];
+        std::ifstream in(source, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open " + source.string());
+        std::ofstream out(target, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot create " + target.string());
+        auto& buf = buffers[worker];
+        buf.resize(1 << 20);
+        ChunkHashRecorder recorder;
+        while (in) {
+            in.read(reinterpret_cast<char*>(buf.data()), std::streamsize(buf.size()));
+            recorder.Update(buf.data(), size_t(in.gcount()));
+            out.write(reinterpret_cast<const char*>(buf.data()), in.gcount());
+        }
+        out.close();
+        if (!out) throw std::runtime_error("copy failed: " + target.string());
+        files[i] = recorder.Finish(target);
+    });
+    return files;
+}
+
+// 在各自的位置解压WIM中的全部元数据与数据流，核对查找表中的SHA-1；解压出错时抛出异常
+bool VerifyWimResources(const WimReader& wim) {
+    std::vector<const WimBlob*> blobs;
+    for (const auto& blob : wim.Metadata()) blobs.push_back(&blob);
+    for (const auto& blob : wim.Blobs()) blobs.push_back(&blob);
+    std::vector<std::ifstream> handles(Executor::Instance().SlotCount());
+    std::atomic<bool> ok{true};
+    ParallelFor(blobs.size(), TaskClass::Cpu, [&](size_t i, unsigned worker) {
+        if (!ok) return;
+        if (!handles[worker].is_open()) handles[worker].open(wim.Path(), std::ios::binary);
+        Sha1 sha;
+        wim.ReadResource(handles[worker], blobs[i]->res, [&](const uint8_t* p, size_t n) { sha.Update(p, n); });
+        if (sha.Final() != blobs[i]->hash) ok = false;
+    });
+    return ok;
+}
+
+// ==================== WIM 分卷写出 ====================
+
+// FAT32单个文件不能超过4GB，分卷大小与 dism /split-image 常用值一致
+const uint64_t kFat32MaxFileSize = 0xFFFFFFFFull;
+const uint64_t kSwmPartSize = 4000ull << 20;
+
+// 一个分卷的内容：第一卷额外包含全部镜像元数据
+struct SwmPart {
+    std::vector<const WimBlob*> resources;
+    uint64_t size = 0;
+};
+
+// 分卷文件名：install.swm, install2.swm, install3.swm ...
+fs::path SwmPartPath(const fs::path& first, size_t number) {
+    if (number == 1) return first;
+    fs::path name = first.stem();
+    name += std::to_string(number);
+    name += first.extension();
+    return first.parent_path() / name;
+}
+
+// 只根据查找表规划分卷（资源原样复制，大小事先可知），
+// 因此每卷的头部可以先写，整个过程是单次顺序读写
+std::vector<SwmPart> PlanSwmParts(const WimReader& wim, uint64_t max_part_size) {
+    const uint64_t fixed = kWimHeaderSize + wim.Header().xml_data.original_size;
+    std::vector<const WimBlob*> blobs;
+    for (const auto& blob : wim.Blobs()) blobs.push_back(&blob);
+    std::sort(blobs.begin(), blobs.end(),
+              [](const WimBlob* a, const WimBlob* b) { return a->res.offset < b->res.offset; });
+
+    std::vector<SwmPart> parts(1);
+    parts[0].size = fixed;
+    for (const auto& meta : wim.Metadata()) {
+        parts[0].resources.push_back(&meta);
+        parts[0].size += meta.res.size_in_wim + kWimLookupEntrySize;
+    }
+    for (const WimBlob* blob : blobs) {
+        uint64_t cost = blob->res.size_in_wim + kWimLookupEntrySize;
+        if (fixed + cost > max_part_size) throw std::runtime_error("resource larger than split part size");
+        if (parts.back().size + cost > max_part_size) parts.push_back({{}, fixed});
+        parts.back().resources.push_back(blob);
+        parts.back().size += cost;
+    }
+    if (parts.size() > 0xFFFF) throw std::runtime_error("too many split parts");
+    return parts;
+}
+
+// 顺序写出一个分卷：头部、资源、查找表、XML
+void WriteSwmPart(const WimReader& wim, std::ifstream& in, const std::vector<uint8_t>& xml,
+                  const std::vector<SwmPart>& parts, size_t index,
+                  const std::function<void(const uint8_t*, size_t)>& sink) {
+    const SwmPart& part = parts[index];
+    WimHeader header = wim.Header();
+    header.flags |= kWimFlagSpanned;
+    header.part_number = uint16_t(index + 1);
+    header.total_parts = uint16_t(parts.size());
+    header.integrity = WimResHdr();
+    if (index != 0) {
+        header.boot_index = 0;
+        header.boot_metadata = WimResHdr();
+    }
+
+    const auto& metadata = wim.Metadata();
+    const WimBlob* boot_metadata =
+        (header.boot_index >= 1 && header.boot_index <= metadata.size()) ? &metadata[header.boot_index - 1] : nullptr;
+    std::vector<uint8_t> table(part.resources.size() * kWimLookupEntrySize);
+    uint64_t offset = kWimHeaderSize;
+    for (size_t i = 0; i < part.resources.size(); ++i) {
+        WimBlob entry = *part.resources[i];
+        entry.res.offset = offset;
+        entry.part_number = header.part_number;
+        WriteLookupEntry(table.data() + i * kWimLookupEntrySize, entry);
+        if (index == 0 && part.resources[i] == boot_metadata) header.boot_metadata = entry.res;
+        offset += entry.res.size_in_wim;
+    }
+    header.lookup_table = {table.size(), 0, offset, table.size()};
+    header.xml_data = {xml.size(), 0, offset + table.size(), xml.size()};
+
+    auto header_bytes = SerializeWimHeader(header);
+    sink(header_bytes.data(), header_bytes.size());
+    for (const WimBlob* blob : part.resources) WimReader::CopyRaw(in, blob->res.offset, blob->res.size_in_wim, sink);
+    sink(table.data(), table.size());
+    sink(xml.data(), xml.size());
+}
+
+// 把WIM按分卷直接写到目标位置（同时记录分块哈希），写完后用原生读取器检查分卷结构
+std::vector<StagedFile> WriteSplitWim(const fs::path& source, const fs::path& first_part, uint64_t max_part_size) {
+    WimReader wim(source);
+    if (wim.Header().total_parts != 1) throw std::runtime_error("source WIM is already split");
+    std::vector<SwmPart> parts = PlanSwmParts(wim, max_part_size);
+    std::ifstream in = wim.Open();
+    std::vector<uint8_t> xml = wim.ReadResource(in, wim.Header().xml_data);
+
+    std::vector<fs::path> paths;
+    std::vector<StagedFile> staged;
+    std::vector<char> out_buffer(8 << 20);
+    for (size_t i = 0; i < parts.size(); ++i) {
+        paths.push_back(SwmPartPath(first_part, i + 1));
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(out_buffer.data(), std::streamsize(out_buffer.size()));
+        out.open(paths.back(), std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot create " + paths.back().string());
+        ChunkHashRecorder recorder;
+        WriteSwmPart(wim, in, xml, parts, i, [&](const uint8_t* p, size_t n) {
+            recorder.Update(p, n);
+            out.write(reinterpret_cast<const char*>(p), std::streamsize(n));
+        });
+        out.close();
+        if (!out) throw std::runtime_error("write failed: " + paths.back().string());
+        staged.push_back(recorder.Finish(paths.back()));
+        std::cout << "[INFO] 已写出分卷 " << paths.back().filename().string() << "（" << (parts[i].size >> 20) << " MB）" << std::endl;
+    }
+
+    // 分卷检查：GUID/卷号一致，每个资源恰好出现一次，且能在分卷中的新位置解压并通过SHA-1校验
+    std::map<Sha1Hash, int> seen;
+    size_t metadata = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        WimReader part(paths[i]);
+        const WimHeader& h = part.Header();
+        if (h.guid != wim.Header().guid || h.part_number != i + 1 || h.total_parts != paths.size() ||
+            !(h.flags & kWimFlagSpanned) || fs::file_size(paths[i]) > max_part_size)
+            throw std::runtime_error("bad split part header: " + paths[i].string());
+        for (const auto& blob : part.Blobs()) seen[blob.hash]++;
+        metadata += part.Metadata().size();
+        if (!VerifyWimResources(part)) throw std::runtime_error("split part resource mismatch: " + paths[i].string());
+    }
+    for (const auto& blob : wim.Blobs()) {
+        if (seen[blob.hash] != 1) throw std::runtime_error("split parts are missing resource " + HashToHex(blob.hash));
+    }
+    if (metadata != wim.Metadata().size() || seen.size() != wim.Blobs().size())
+        throw std::runtime_error("split parts do not match source WIM");
+    return staged;
+}
+
+// ==================== FAT32镜像 ====================
+
+const uint32_t kFatSectorSize = 512;
+const uint32_t kFatReservedSectors = 32;
+const uint32_t kFatMinClusters = 65525;  // 少于这个簇数的卷会被识别为FAT16
+const uint32_t kFatMaxClusters = 0x0FFFFFF4;
+const uint32_t kFatEndOfChain = 0x0FFFFFFF;
+const uint64_t kFatImageHeadroom = 64ull << 20;  // 生成镜像文件时给PE运行预留的空闲空间
+const uint8_t kFatAttrVolumeId = 0x08, kFatAttrLongName = 0x0F;
+const uint8_t kFatLowerBase = 0x08, kFatLowerExt = 0x10;  // 目录项NT保留字节：8.3名字的主名/扩展名为小写
+
+// 整卷顺序写出与回读。Windows上 \\.\X: 形式的路径表示卷设备：先锁定并卸载卷再写；
+// 读写都绕过系统缓存，写完后的回读反映的是盘上的实际内容
+class VolumeFile {
+public:
+    static const size_t kAlign = 4096;
+
+    explicit VolumeFile(const fs::path& path) : path_(path), storage_(kBufferSize + kAlign) {
+        buffer_ = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(storage_.data()) + kAlign - 1) &
+                                             ~uintptr_t(kAlign - 1));
+#ifdef _WIN32
+        device_ = IsDevicePath(path);
+        handle_ = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              device_ ? OPEN_EXISTING : CREATE_ALWAYS,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, nullptr);
+        if (handle_ == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open " + path.string());
+        if (device_) {
+            DWORD bytes = 0;
+            if (!DeviceIoControl(handle_, FSCTL_LOCK_VOLUME, nullptr, 0, nullptr, 0, &bytes, nullptr) ||
+                !DeviceIoControl(handle_, FSCTL_DISMOUNT_VOLUME, nullptr, 0, nullptr, 0, &bytes, nullptr)) {
+                CloseHandle(handle_);
+                throw std::runtime_error("cannot lock volume " + path.string());
+            }
+            GET_LENGTH_INFORMATION length{};
+            if (!DeviceIoControl(handle_, IOCTL_DISK_GET_LENGTH_INFO, nullptr, 0, &length, sizeof(length), &bytes,
+                                 nullptr)) {
+                CloseHandle(handle_);
+                throw std::runtime_error("cannot query volume size " + path.string());
+            }
+            device_size_ = uint64_t(length.Length.QuadPart);
+            PARTITION_INFORMATION_EX partition{};
+            if (DeviceIoControl(handle_, IOCTL_DISK_GET_PARTITION_INFO_EX, nullptr, 0, &partition, sizeof(partition),
+                                &bytes, nullptr))
+                hidden_sectors_ = uint32_t(partition.StartingOffset.QuadPart / kFatSectorSize);
+        }
+#else
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) throw std::runtime_error("cannot create " + path.string());
+#endif
+    }
+
+    ~VolumeFile() {
+#ifdef _WIN32
+        if (device_) {
+            DWORD bytes = 0;
+            DeviceIoControl(handle_, FSCTL_UNLOCK_VOLUME, nullptr, 0, nullptr, 0, &bytes, nullptr);
+        }
+        CloseHandle(handle_);
+#else
+        close(fd_);
+#endif
+    }
+    VolumeFile(const VolumeFile&) = delete;
+    VolumeFile& operator=(const VolumeFile&) = delete;
+
+    const fs::path& Path() const { return path_; }
+    bool IsDevice() const { return device_; }
+    uint64_t DeviceSize() const { return device_size_; }  // 普通文件为0
+    uint32_t HiddenSectors() const { return hidden_sectors_; }
+    uint64_t Position() const { return written_ + filled_; }
+
+    void Write(const uint8_t* p, size_t n) {
+        while (n > 0) {
+            size_t take = std::min(n, kBufferSize - filled_);
+            memcpy(buffer_ + filled_, p, take);
+            filled_ += take;
+            p += take;
+            n -= take;
+            if (filled_ == kBufferSize) Drain();
+        }
+    }
+
+    void WriteZeros(uint64_t n) {
+        while (n > 0) {
+            size_t take = size_t(std::min<uint64_t>(n, kBufferSize - filled_));
+            memset(buffer_ + filled_, 0, take);
+            filled_ += take;
+            n -= take;
+            if (filled_ == kBufferSize) Drain();
+        }
+    }
+
+    // 写出缓冲区并刷到盘上
+    void Flush() {
+        Drain();
+#ifdef _WIN32
+        FlushFileBuffers(handle_);
+#else
+        if (fsync(fd_) != 0) throw std::runtime_error("fsync failed: " + path_.string());
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    }
+
+    // 按位置读取，可在多个线程中同时调用
+    void ReadAt(uint64_t offset, uint8_t* buf, size_t size) const {
+        uint64_t start = offset & ~uint64_t(kAlign - 1);
+        size_t head = size_t(offset - start);
+        size_t length = (head + size + kAlign - 1) & ~(kAlign - 1);
+        std::vector<uint8_t> storage(length + kAlign);
+        uint8_t* aligned = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(storage.data()) + kAlign - 1) &
+                                                      ~uintptr_t(kAlign - 1));
+        size_t done = 0;
+        while (done < head + size) {
+#ifdef _WIN32
+            OVERLAPPED ov{};
+            ov.Offset = DWORD(start + done);
+            ov.OffsetHigh = DWORD((start + done) >> 32);
+            DWORD got = 0;
+            if (!ReadFile(handle_, aligned + done, DWORD(std::min<size_t>(length - done, 1u << 30)), &got, &ov) || got == 0)
+                throw std::runtime_error("read failed: " + path_.string());
+#else
+            ssize_t got = pread(fd_, aligned + done, length - done, off_t(start + done));
+            if (got <= 0) throw std::runtime_error("read failed: " + path_.string());
+#endif
+            done += size_t(got);
+        }
+        memcpy(buf, aligned + head, size);
+    }
+
+private:
+    static const size_t kBufferSize = size_t(8) << 20;
+
+    // 无缓冲写要求长度按扇区对齐；卷上的内容都是扇区的整数倍，卷设备末尾多写的只是空闲簇
+    void Drain() {
+        if (filled_ == 0) return;
+        size_t length = filled_;
+#ifdef _WIN32
+        length = (filled_ + kAlign - 1) & ~(kAlign - 1);
+        memset(buffer_ + filled_, 0, length - filled_);
+        OVERLAPPED ov{};
+        ov.Offset = DWORD(written_);
+        ov.OffsetHigh = DWORD(written_ >> 32);
+        DWORD done = 0;
+        if (!WriteFile(handle_, buffer_, DWORD(length), &done, &ov) || done != length)
+            throw std::runtime_error("write failed: " + path_.string());
+#else
+        for (size_t done = 0; done < length;) {
+            ssize_t n = pwrite(fd_, buffer_ + done, length - done, off_t(written_ + done));
+            if (n <= 0) throw std::runtime_error("write failed: " + path_.string());
+            done += size_t(n);
+        }
+#endif
+        written_ += filled_;
+        filled_ = 0;
+    }
+
+    fs::path path_;
+    std::vector<uint8_t> storage_;
+    uint8_t* buffer_;
+    size_t filled_ = 0;
+    uint64_t written_ = 0;
+    bool device_ = false;
+    uint64_t device_size_ = 0;
+    uint32_t hidden_sectors_ = 0;
+#ifdef _WIN32
+    HANDLE handle_;
+#else
+    int fd_;
+#endif
+};
+
+struct Fat32Geometry {
+    uint32_t total_sectors = 0;
+    uint32_t sectors_per_cluster = 0;
+    uint32_t reserved_sectors = 0;
+    uint32_t fat_sectors = 0;
+    uint32_t cluster_count = 0;
+    uint32_t hidden_sectors = 0;
+
+    uint32_t ClusterSize() const { return sectors_per_cluster * kFatSectorSize; }
+    uint64_t DataOffset() const { return uint64_t(reserved_sectors + 2 * fat_sectors) * kFatSectorSize; }
+    uint64_t ClusterOffset(uint32_t cluster) const { return DataOffset() + uint64_t(cluster - 2) * ClusterSize(); }
+};
+
+// 与 format 的默认簇大小一致
+uint32_t Fat32SectorsPerCluster(uint64_t volume_bytes) {
+    const uint64_t MB = 1 << 20;
+    if (volume_bytes <= 64 * MB) return 1;
+    if (volume_bytes <= 128 * MB) return 2;
+    if (volume_bytes <= 256 * MB) return 4;
+    if (volume_bytes <= 8192 * MB) return 8;
+    if (volume_bytes <= 16384 * MB) return 16;
+    if (volume_bytes <= 32768 * MB) return 32;
+    return 64;
+}
+
+// 由总扇区数计算FAT大小和簇数；保留区按需加大，使数据区按4KB对齐
+Fat32Geometry ComputeFat32Geometry(uint64_t total_sectors, uint32_t sectors_per_cluster) {
+    if (total_sectors > 0xFFFFFFFF) throw std::runtime_error("volume too large for FAT32");
+    Fat32Geometry g;
+    g.total_sectors = uint32_t(total_sectors);
+    g.sectors_per_cluster = sectors_per_cluster;
+    uint32_t fat = 1;
+    for (;;) {
+        uint32_t reserved = kFatReservedSectors;
+        while ((reserved + 2 * fat) % 8 != 0) ++reserved;
+        if (total_sectors <= reserved + 2ull * fat) throw std::runtime_error("volume too small for FAT32");
+        uint32_t clusters = uint32_t((total_sectors - reserved - 2ull * fat) / sectors_per_cluster);
+        uint32_t need = uint32_t((uint64_t(clusters + 2) * 4 + kFatSectorSize - 1) / kFatSectorSize);
+        if (need <= fat) {
+            g.reserved_sectors = reserved;
+            g.fat_sectors = fat;
+            g.cluster_count = clusters;
+            break;
+        }
+        fat = need;
+    }
+    if (g.cluster_count < kFatMinClusters || g.cluster_count > kFatMaxClusters)
+        throw std::runtime_error("cluster count out of FAT32 range");
+    return g;
+}
+
+// 目录项时间：FILETIME转为本地时间的FAT日期/时间，0表示当前时间
+void FatDateTime(uint64_t filetime, uint16_t& date, uint16_t& time) {
+    const uint64_t kEpochDelta = 11644473600ull;  // 1601-01-01 到 1970-01-01 的秒数
+    const int64_t kFatEpoch = 315532800;           // 1980-01-01
+    std::time_t t = filetime ? std::time_t(int64_t(filetime / 10000000) - int64_t(kEpochDelta)) : std::time(nullptr);
+    if (t < kFatEpoch) t = kFatEpoch;
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &t);
+#else
+    localtime_r(&t, &tm);
+#endif
+    int year = std::min(std::max(tm.tm_year + 1900, 1980), 2107);
+    date = uint16_t(((year - 1980) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday);
+    time = uint16_t((tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2));
+}
+
+bool FatNameEquals(const std::u16string& a, const std::u16string& b) {
+    auto upper = [](char16_t c) { return (c >= u'a' && c <= u'z') ? char16_t(c - 32) : c; };
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [&](char16_t x, char16_t y) { return upper(x) == upper(y); });
+}
+
+uint8_t FatShortNameChecksum(const uint8_t* name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; ++i) sum = uint8_t(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    return sum;
+}
+
+// 镜像中的一个文件或目录。文件内容来自WIM资源（wim/blob）或 produce，后者须按顺序输出恰好 size 字节
+struct FatNode {
+    std::u16string name;
+    bool is_directory = false;
+    uint8_t attributes = 0;
+    uint64_t write_time = 0;  // FILETIME，0 表示构建时间
+    uint64_t size = 0;
+    const WimReader* wim = nullptr;
+    const WimBlob* blob = nullptr;
+    std::function<void(const std::function<void(const uint8_t*, size_t)>&)> produce;
+    std::vector<std::unique_ptr<FatNode>> children;
+
+    // 布局结果
+    std::array<uint8_t, 11> short_name{};
+    uint8_t case_flags = 0;
+    bool long_name = false;
+    uint32_t first_cluster = 0;
+    uint32_t clusters = 0;
+    std::vector<uint8_t> dir_data;
+    std::vector<Sha1Hash> chunks;  // 写出时记录的分块哈希，回读校验用
+};
+
+// 把整个PE分区的内容排成一个FAT32卷：所有文件和目录都占用连续的簇，按簇号顺序一次写完，
+// 不经过文件系统驱动，也就没有逐个文件的元数据更新
+class Fat32Builder {
+public:
+    Fat32Builder() : root_(std::make_unique<FatNode>()) {
+        root_->is_directory = true;
+        root_->attributes = kAttrDirectory;
+    }
+
+    FatNode& Root() { return *root_; }
+    const Fat32Geometry& Geometry() const { return geometry_; }
+    size_t FileCount() const { return files_; }
+    uint64_t PayloadBytes() const { return payload_; }
+    size_t DecodedBlobs() const { return decoded_blobs_; }
+
+    // 逐级查找或创建目录（名字不区分大小写）
+    FatNode* Directory(const fs::path& rel) {
+        FatNode* dir = root_.get();
+        for (const auto& part : rel) {
+            std::u16string name = part.u16string();
+            if (name.empty() || name == u".") continue;
+            FatNode* child = Find(*dir, name);
+            if (child && !child->is_directory) throw std::runtime_error("path is a file: " + rel.string());
+            if (!child) {
+                dir->children.push_back(std::make_unique<FatNode>());
+                child = dir->children.back().get();
+                child->name = CheckName(name, rel);
+                child->is_directory = true;
+                child->attributes = kAttrDirectory;
+            }
+            dir = child;
+        }
+        return dir;
+    }
+
+    // 添加文件，同名文件被替换（与 xcopy /y 相同）
+    FatNode* AddFile(const fs::path& rel, uint64_t size, uint8_t attributes = kAttrArchive) {
+        if (size > kFat32MaxFileSize) throw std::runtime_error("file too large for FAT32: " + rel.string());
+        FatNode* dir = Directory(rel.parent_path());
+        std::u16string name = CheckName(rel.filename().u16string(), rel);
+        FatNode* node = Find(*dir, name);
+        if (node && node->is_directory) throw std::runtime_error("path is a directory: " + rel.string());
+        if (node) {
+            payload_ -= node->size;
+            name = node->name;  // 覆盖时保留原有的大小写
+            *node = FatNode();
+        } else {
+            dir->children.push_back(std::make_unique<FatNode>());
+            node = dir->children.back().get();
+            files_++;
+        }
+        node->name = name;
+        node->size = size;
+        node->attributes = uint8_t(attributes & ~kAttrDirectory);
+        payload_ += size;
+        return node;
+    }
+
+    void AddLocalFile(const fs::path& rel, const fs::path& source) {
+        FatNode* node = AddFile(rel, fs::file_size(source));
+        node->produce = [source](const std::function<void(const uint8_t*, size_t)>& sink) {
+            std::ifstream in(source, std::ios::binary);
+            if (!in) throw std::runtime_error("cannot open " + source.string());
+            std::vector<char> buf(4 << 20);
+            while (in) {
+                in.read(buf.data(), std::streamsize(buf.size()));
+                if (in.gcount() > 0) sink(reinterpret_cast<const uint8_t*>(buf.data()), size_t(in.gcount()));
+            }
+            if (in.bad()) throw std::runtime_error("read failed: " + source.string());
+        };
+    }
+
+    void AddBytes(const fs::path& rel, const std::string& bytes) {
+        FatNode* node = AddFile(rel, bytes.size());
+        node->produce = [bytes](const std::function<void(const uint8_t*, size_t)>& sink) {
+            sink(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+        };
+    }
+
+    // 把WIM中的一个镜像放进卷的根目录；重解析点与命名数据流不受FAT32支持，和原生释放一样跳过
+    void AddWimImage(const WimReader& wim, uint32_t index) {
+        std::ifstream in = wim.Open();
+        for (const auto& d : wim.ReadImage(in, index)) {
+            uint8_t attributes = uint8_t(d.attributes & (kAttrReadonly | kAttrHidden | kAttrSystem | kAttrArchive));
+            if (d.IsReparsePoint()) continue;
+            if (d.IsDirectory()) {
+                FatNode* dir = Directory(d.path);
+                if (dir != root_.get()) {
+                    dir->attributes = uint8_t(attributes | kAttrDirectory);
+                    dir->write_time = d.last_write_time;
+                }
+                continue;
+            }
+            const WimBlob* blob = IsZeroHash(d.hash) ? nullptr : wim.FindBlob(d.hash);
+            if (!IsZeroHash(d.hash) && !blob) throw std::runtime_error("missing resource " + HashToHex(d.hash));
+            FatNode* node = AddFile(d.path, blob ? blob->res.original_size : 0, attributes);
+            node->wim = &wim;
+            node->blob = blob;
+            node->write_time = d.last_write_time;
+        }
+    }
+
+    // 计算布局。volume_bytes 为0时按内容决定卷大小（另留 kFatImageHeadroom 空闲），否则使用整个卷
+    const Fat32Geometry& Layout(uint64_t volume_bytes, uint32_t hidden_sectors) {
+        AssignShortNames(*root_);
+        if (volume_bytes == 0) {
+            uint32_t spc = Fat32SectorsPerCluster(payload_ + kFatImageHeadroom);
+            uint64_t needed = CountClusters(*root_, spc * kFatSectorSize);
+            uint64_t clusters = std::max<uint64_t>(needed + kFatImageHeadroom / (spc * kFatSectorSize), kFatMinClusters + 64);
+            uint64_t fat = (clusters + 2) * 4 / kFatSectorSize + 1;
+            uint64_t total = kFatReservedSectors + 8 + 2 * fat + clusters * spc;
+            geometry_ = ComputeFat32Geometry((total + 7) & ~uint64_t(7), spc);
+        } else {
+            geometry_ = ComputeFat32Geometry(volume_bytes / kFatSectorSize, Fat32SectorsPerCluster(volume_bytes));
+        }
+        geometry_.hidden_sectors = hidden_sectors;
+        uint64_t needed = CountClusters(*root_, geometry_.ClusterSize());
+        if (needed > geometry_.cluster_count)
+            throw std::runtime_error("PE volume too small: need " + std::to_string(needed * geometry_.ClusterSize() >> 20) + " MB");
+
+        order_.clear();
+        next_cluster_ = 2;
+        Assign(*root_);
+        BuildDirectory(*root_, nullptr);
+        return geometry_;
+    }
+
+    // 按簇号顺序写出整个卷；fill_free 为 false 时不写末尾的空闲区（直接写卷设备时）
+    void Write(VolumeFile& out, bool fill_free) {
+        const Fat32Geometry& g = geometry_;
+        std::vector<uint8_t> reserved(size_t(g.reserved_sectors) * kFatSectorSize);
+        BootSector(reserved.data());
+        FsInfoSector(reserved.data() + kFatSectorSize);
+        PutLE16(reserved.data() + 2 * kFatSectorSize + 510, 0xAA55);
+        memcpy(reserved.data() + 6 * kFatSectorSize, reserved.data(), 3 * kFatSectorSize);  // 备份引导扇区
+        out.Write(reserved.data(), reserved.size());
+
+        std::vector<uint8_t> fat(size_t(next_cluster_) * 4);
+        PutLE32(fat.data(), 0x0FFFFFF8);
+        PutLE32(fat.data() + 4, kFatEndOfChain);
+        for (const FatNode* node : order_) {
+            for (uint32_t i = 0; i < node->clusters; ++i) {
+                uint32_t c = node->first_cluster + i;
+                PutLE32(fat.data() + size_t(c) * 4, i + 1 == node->clusters ? kFatEndOfChain : c + 1);
+            }
+        }
+        for (int copy = 0; copy < 2; ++copy) {
+            out.Write(fat.data(), fat.size());
+            out.WriteZeros(uint64_t(g.fat_sectors) * kFatSectorSize - fat.size());
+        }
+
+        // WIM中的文件成批在CPU线程上并行解压，再按顺序写出；本地文件边读边写。
+        // 同一数据流只解码一次：批内去重，被后面的批再次引用的数据保留到最后一次使用
+        const uint64_t kBatchBytes = 64ull << 20;
+        Executor& executor = Executor::Instance();
+        std::vector<std::ifstream> handles(executor.SlotCount());
+        std::map<const WimBlob*, size_t> last_use;
+        for (size_t k = 0; k < order_.size(); ++k)
+            if (order_[k]->blob && !order_[k]->produce) last_use[order_[k]->blob] = k;
+        std::map<const WimBlob*, std::vector<uint8_t>> decoded;
+        const std::vector<uint8_t> empty;
+        uint64_t done = 0;
+        int last_percent = -1;
+        for (size_t i = 0; i < order_.size();) {
+            size_t j = i;
+            uint64_t batch = 0;
+            while (j < order_.size() && !order_[j]->produce && (j == i || batch + order_[j]->size <= kBatchBytes))
+                batch += order_[j++]->size;
+            if (j == i) {
+                Emit(out, *order_[i], nullptr);
+                done += order_[i++]->size;
+            } else {
+                std::vector<const FatNode*> pending;
+                for (size_t k = i; k < j; ++k) {
+                    const WimBlob* blob = order_[k]->blob;
+                    if (blob && decoded.emplace(blob, std::vector<uint8_t>()).second) pending.push_back(order_[k]);
+                }
+                decoded_blobs_ += pending.size();
+                ParallelFor(pending.size(), TaskClass::Cpu, [&](size_t k, unsigned slot) {
+                    const FatNode& node = *pending[k];
+                    if (!handles[slot].is_open()) handles[slot].open(node.wim->Path(), std::ios::binary);
+                    // 各任务只写自己的元素，map结构在批内不再变化
+                    std::vector<uint8_t>& data = decoded.find(node.blob)->second;
+                    data = node.wim->ReadResource(handles[slot], node.blob->res);
+                    if (ComputeSha1(data.data(), data.size()) != node.blob->hash)
+                        throw std::runtime_error("SHA-1 mismatch in " + node.wim->Path().string());
+                });
+                for (size_t k = i; k < j; ++k) {
+                    const WimBlob* blob = order_[k]->blob;
+                    Emit(out, *order_[k], blob ? &decoded.at(blob) : &empty);
+                    if (blob && last_use.at(blob) == k) decoded.erase(blob);
+                }
+                done += batch;
+                i = j;
+            }
+            int percent = int(done * 100 / std::max<uint64_t>(payload_, 1));
+            if (percent / 10 > last_percent / 10) {
+                last_percent = percent;
+                std::cout << "[INFO] FAT32镜像已写出 " << percent << "%" << std::endl;
+            }
+        }
+        if (fill_free) out.WriteZeros(uint64_t(g.total_sectors) * kFatSectorSize - out.Position());
+        out.Flush();
+    }
+
+private:
+    static std::u16string CheckName(const std::u16string& name, const fs::path& rel) {
+        static const std::u16string kInvalid = u"\"*/:<>?\\|";
+        bool ok = !name.empty() && name.size() <= 255 && name != u"." && name != u"..";
+        for (char16_t c : name) ok = ok && c >= 0x20 && kInvalid.find(c) == std::u16string::npos;
+        if (!ok) throw std::runtime_error("invalid FAT32 name: " + rel.string());
+        return name;
+    }
+
+    static FatNode* Find(const FatNode& dir, const std::u16string& name) {
+        for (const auto& child : dir.children) {
+            if (FatNameEquals(child->name, name)) return child.get();
+        }
+        return nullptr;
+    }
+
+    static bool ValidShortChar(char16_t c) {
+        return (c >= u'A' && c <= u'Z') || (c >= u'0' && c <= u'9') ||
+               (c < 0x80 && c > 0x20 && std::u16string(u"!#$%&'()-@^_`{}~").find(c) != std::u16string::npos);
+    }
+
+    // 名字本身是合法8.3（主名、扩展名各自全大写或全小写）时不需要长文件名
+    static bool ExactShortName(const std::u16string& name, std::array<uint8_t, 11>& out, uint8_t& flags) {
+        size_t dot = name.find(u'.');
+        std::u16string base = name.substr(0, dot);
+        std::u16string ext = dot == std::u16string::npos ? u"" : name.substr(dot + 1);
+        if (base.empty() || base.size() > 8 || ext.size() > 3 || ext.find(u'.') != std::u16string::npos ||
+            (dot != std::u16string::npos && ext.empty()))
+            return false;
+        flags = 0;
+        auto convert = [&](const std::u16string& part, uint8_t* dst, uint8_t lower_flag) {
+            bool upper = false, lower = false;
+            for (size_t i = 0; i < part.size(); ++i) {
+                char16_t c = part[i];
+                if (c >= u'a' && c <= u'z') {
+                    lower = true;
+                    c = char16_t(c - 32);
+                } else if (c >= u'A' && c <= u'Z') {
+                    upper = true;
+                }
+                if (!ValidShortChar(c)) return false;
+                dst[i] = uint8_t(c);
+            }
+            if (upper && lower) return false;
+            if (lower) flags |= lower_flag;
+            return true;
+        };
+        out.fill(' ');
+        return convert(base, out.data(), kFatLowerBase) && convert(ext, out.data() + 8, kFatLowerExt);
+    }
+
+    // 其他名字另写长文件名目录项；短文件名取大写形式，转换有损或重名时改为 BASE~N.EXT
+    static void AssignShortNames(FatNode& dir) {
+        std::set<std::string> used;
+        auto key = [](const std::array<uint8_t, 11>& n) { return std::string(n.begin(), n.end()); };
+        for (auto& child : dir.children) {
+            child->long_name = !ExactShortName(child->name, child->short_name, child->case_flags) ||
+                               !used.insert(key(child->short_name)).second;
+        }
+        for (auto& child : dir.children) {
+            if (child->long_name) {
+                const std::u16string& name = child->name;
+                size_t start = name.find_first_not_of(u'.');
+                size_t dot = name.rfind(u'.');
+                if (dot != std::u16string::npos && dot < start) dot = std::u16string::npos;
+                bool lossy = start != 0;
+                std::string base, ext;
+                auto append = [&](std::string& part, char16_t c) {
+                    if (c == u' ' || c == u'.') {
+                        lossy = true;
+                        return;
+                    }
+                    if (c >= u'a' && c <= u'z') c = char16_t(c - 32);
+                    lossy = lossy || !ValidShortChar(c);
+                    part += ValidShortChar(c) ? char(c) : '_';
+                };
+                for (size_t i = start; i < name.size() && i != dot; ++i) append(base, name[i]);
+                for (size_t i = dot == std::u16string::npos ? name.size() : dot + 1; i < name.size(); ++i) append(ext, name[i]);
+                lossy = lossy || base.empty() || base.size() > 8 || ext.size() > 3;
+                if (base.empty()) base = "_";
+                if (ext.size() > 3) ext.resize(3);
+                child->case_flags = 0;
+                child->short_name.fill(' ');
+                memcpy(child->short_name.data(), base.data(), std::min<size_t>(base.size(), 8));
+                memcpy(child->short_name.data() + 8, ext.data(), ext.size());
+                for (uint32_t n = 1; lossy || !used.insert(key(child->short_name)).second; ++n) {
+                    if (n > 999999) throw std::runtime_error("too many similar names in one directory");
+                    std::string tail = "~" + std::to_string(n);
+                    std::string candidate = base.substr(0, std::min(base.size(), 8 - tail.size())) + tail;
+                    child->short_name.fill(' ');
+                    memcpy(child->short_name.data(), candidate.data(), candidate.size());
+                    memcpy(child->short_name.data() + 8, ext.data(), ext.size());
+                    lossy = false;
+                }
+            }
+            if (child->is_directory) AssignShortNames(*child);
+        }
+    }
+
+    static size_t DirectoryBytes(const FatNode& dir, bool is_root) {
+        size_t entries = is_root ? 1 : 2;  // 根目录有卷标，子目录有 . 和 ..
+        for (const auto& child : dir.children) entries += 1 + (child->long_name ? (child->name.size() + 12) / 13 : 0);
+        if (entries > 65536) throw std::runtime_error("too many entries in one directory");
+        return entries * 32;
+    }
+
+    uint64_t CountClusters(const FatNode& dir, uint32_t cluster_size) const {
+        uint64_t total = std::max<uint64_t>(1, (DirectoryBytes(dir, &dir == root_.get()) + cluster_size - 1) / cluster_size);
+        for (const auto& child : dir.children) {
+            total += child->is_directory ? CountClusters(*child, cluster_size) : (child->size + cluster_size - 1) / cluster_size;
+        }
+        return total;
+    }
+
+    // 先序分配：目录本身，接着它的文件，再进入子目录；每个对象都是连续的一段簇
+    void Assign(FatNode& dir) {
+        const uint32_t cs = geometry_.ClusterSize();
+        dir.clusters = uint32_t(std::max<size_t>(1, (DirectoryBytes(dir, &dir == root_.get()) + cs - 1) / cs));
+        dir.first_cluster = next_cluster_;
+        next_cluster_ += dir.clusters;
+        order_.push_back(&dir);
+        for (auto& child : dir.children) {
+            if (child->is_directory || child->size == 0) continue;
+            child->clusters = uint32_t((child->size + cs - 1) / cs);
+            child->first_cluster = next_cluster_;
+            next_cluster_ += child->clusters;
+            order_.push_back(child.get());
+        }
+        for (auto& child : dir.children) {
+            if (child->is_directory) Assign(*child);
+        }
+    }
+
+    static void PutEntry(uint8_t* e, const uint8_t* name, uint8_t attributes, uint8_t case_flags, uint32_t cluster,
+                         uint32_t size, uint64_t write_time) {
+        uint16_t date = 0, time = 0;
+        FatDateTime(write_time, date, time);
+        memcpy(e, name, 11);
+        e[11] = attributes;
+        e[12] = case_flags;
+        PutLE16(e + 14, time);
+        PutLE16(e + 16, date);
+        PutLE16(e + 18, date);
+        PutLE16(e + 20, uint16_t(cluster >> 16));
+        PutLE16(e + 22, time);
+        PutLE16(e + 24, date);
+        PutLE16(e + 26, uint16_t(cluster));
+        PutLE32(e + 28, size);
+    }
+
+    void BuildDirectory(FatNode& dir, const FatNode* parent) {
+        static const int kLfnOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+        dir.dir_data.assign(size_t(dir.clusters) * geometry_.ClusterSize(), 0);
+        uint8_t* e = dir.dir_data.data();
+        if (!parent) {
+            PutEntry(e, reinterpret_cast<const uint8_t*>("PE         "), kFatAttrVolumeId, 0, 0, 0, 0);
+            e += 32;
+        } else {
+            uint32_t parent_cluster = parent == root_.get() ? 0 : parent->first_cluster;
+            PutEntry(e, reinterpret_cast<const uint8_t*>(".          "), kAttrDirectory, 0, dir.first_cluster, 0, dir.write_time);
+            PutEntry(e + 32, reinterpret_cast<const uint8_t*>("..         "), kAttrDirectory, 0, parent_cluster, 0, dir.write_time);
+            e += 64;
+        }
+        for (auto& child : dir.children) {
+            if (child->long_name) {
+                const std::u16string& name = child->name;
+                const size_t count = (name.size() + 12) / 13;
+                const uint8_t checksum = FatShortNameChecksum(child->short_name.data());
+                for (size_t k = count; k >= 1; --k, e += 32) {
+                    e[0] = uint8_t(k | (k == count ? 0x40 : 0));
+                    e[11] = kFatAttrLongName;
+                    e[13] = checksum;
+                    for (size_t j = 0; j < 13; ++j) {
+                        size_t idx = (k - 1) * 13 + j;
+                        PutLE16(e + kLfnOffsets[j], idx < name.size() ? uint16_t(name[idx]) : idx == name.size() ? 0 : 0xFFFF);
+                    }
+                }
+            }
+            PutEntry(e, child->short_name.data(), child->attributes, child->case_flags, child->first_cluster,
+                     uint32_t(child->size), child->write_time);
+            e += 32;
+        }
+        for (auto& child : dir.children) {
+            if (child->is_directory) BuildDirectory(*child, &dir);
+        }
+    }
+
+    void BootSector(uint8_t* s) const {
+        const Fat32Geometry& g = geometry_;
+        static const uint8_t kJump[3] = {0xEB, 0x58, 0x90};
+        memcpy(s, kJump, 3);
+        memcpy(s + 3, "MSWIN4.1", 8);
+        PutLE16(s + 11, uint16_t(kFatSectorSize));
+        s[13] = uint8_t(g.sectors_per_cluster);
+        PutLE16(s + 14, uint16_t(g.reserved_sectors));
+        s[16] = 2;      // FAT份数
+        s[21] = 0xF8;   // 固定磁盘
+        PutLE16(s + 24, 63);
+        PutLE16(s + 26, 255);
+        PutLE32(s + 28, g.hidden_sectors);
+        PutLE32(s + 32, g.total_sectors);
+        PutLE32(s + 36, g.fat_sectors);
+        PutLE32(s + 44, 2);  // 根目录起始簇
+        PutLE16(s + 48, 1);  // FSInfo扇区
+        PutLE16(s + 50, 6);  // 备份引导扇区
+        s[64] = 0x80;
+        s[66] = 0x29;
+        PutLE32(s + 67, uint32_t(std::random_device{}()));
+        memcpy(s + 71, "PE         ", 11);
+        memcpy(s + 82, "FAT32   ", 8);
+        PutLE16(s + 510, 0xAA55);
+    }
+
+    void FsInfoSector(uint8_t* s) const {
+        PutLE32(s, 0x41615252);
+        PutLE32(s + 484, 0x61417272);
+        PutLE32(s + 488, geometry_.cluster_count - (next_cluster_ - 2));
+        PutLE32(s + 492, next_cluster_);
+        PutLE32(s + 508, 0xAA550000);
+    }
+
+    // 写出一个对象并补齐到整簇，同时记录分块哈希
+    void Emit(VolumeFile& out, FatNode& node, const std::vector<uint8_t>* data) {
+        if (out.Position() != geometry_.ClusterOffset(node.first_cluster))
+            throw std::runtime_error("FAT32 layout out of sync");
+        ChunkHashRecorder recorder;
+        uint64_t written = 0;
+        auto sink = [&](const uint8_t* p, size_t n) {
+            if (written + n > node.size) throw std::runtime_error("file grew while building FAT32 image");
+            recorder.Update(p, n);
+            out.Write(p, n);
+            written += n;
+        };
+        if (node.is_directory) {
+            out.Write(node.dir_data.data(), node.dir_data.size());
+            return;
+        }
+        if (data) sink(data->data(), data->size());
+        else node.produce(sink);
+        if (written != node.size) throw std::runtime_error("file size changed while building FAT32 image");
+        node.chunks = recorder.Finish(fs::path()).chunks;
+        out.WriteZeros(uint64_t(node.clusters) * geometry_.ClusterSize() - node.size);
+    }
+
+    std::unique_ptr<FatNode> root_;
+    Fat32Geometry geometry_;
+    std::vector<FatNode*> order_;
+    uint32_t next_cluster_ = 2;
+    size_t files_ = 0;
+    uint64_t payload_ = 0;
+    size_t decoded_blobs_ = 0;
+};
+
+// 独立于写入代码的FAT32读取器：只依据引导扇区、FAT和目录项解析卷，用于回读校验生成的镜像
+class Fat32Reader {
+public:
+    struct Entry {
+        std::u16string name;
+        std::string short_name;
+        uint8_t attributes = 0;
+        uint32_t first_cluster = 0;
+        uint32_t size = 0;
+        bool IsDirectory() const { return (attributes & kAttrDirectory) != 0; }
+    };
+
+    explicit Fat32Reader(const VolumeFile& volume) : volume_(volume) {
+        uint8_t s[kFatSectorSize];
+        volume_.ReadAt(0, s, sizeof(s));
+        bytes_per_sector_ = GetLE16(s + 11);
+        sectors_per_cluster_ = s[13];
+        uint32_t reserved = GetLE16(s + 14);
+        uint32_t fats = s[16];
+        uint32_t total = GetLE32(s + 32);
+        uint32_t fat_sectors = GetLE32(s + 36);
+        root_cluster_ = GetLE32(s + 44);
+        if (GetLE16(s + 510) != 0xAA55 || memcmp(s + 82, "FAT32   ", 8) != 0 || bytes_per_sector_ < 512 ||
+            (bytes_per_sector_ & (bytes_per_sector_ - 1)) || sectors_per_cluster_ == 0 ||
+            (sectors_per_cluster_ & (sectors_per_cluster_ - 1)) || fats == 0 || GetLE16(s + 17) != 0 ||
+            fat_sectors == 0)
+            throw std::runtime_error("not a FAT32 volume");
+        data_offset_ = uint64_t(reserved + fats * fat_sectors) * bytes_per_sector_;
+        cluster_count_ = (total - reserved - fats * fat_sectors) / sectors_per_cluster_;
+        if (cluster_count_ < kFatMinClusters || uint64_t(cluster_count_ + 2) * 4 > uint64_t(fat_sectors) * bytes_per_sector_)
+            throw std::runtime_error("bad FAT32 geometry");
+
+        // 各份FAT必须一致
+        std::vector<uint8_t> fat(size_t(cluster_count_ + 2) * 4), copy(fat.size());
+        volume_.ReadAt(uint64_t(reserved) * bytes_per_sector_, fat.data(), fat.size());
+        for (uint32_t i = 1; i < fats; ++i) {
+            volume_.ReadAt(uint64_t(reserved + i * fat_sectors) * bytes_per_sector_, copy.data(), copy.size());
+            if (copy != fat) throw std::runtime_error("FAT copies differ");
+        }
+        fat_.resize(cluster_count_ + 2);
+        for (size_t i = 0; i < fat_.size(); ++i) fat_[i] = GetLE32(fat.data() + i * 4) & 0x0FFFFFFF;
+    }
+
+    uint32_t RootCluster() const { return root_cluster_; }
+    uint32_t ClusterSize() const { return bytes_per_sector_ * sectors_per_cluster_; }
+    uint64_t ClusterOffset(uint32_t cluster) const { return data_offset_ + uint64_t(cluster - 2) * ClusterSize(); }
+
+    std::vector<uint32_t> Chain(uint32_t first) const {
+        std::vector<uint32_t> chain;
+        for (uint32_t c = first; c < 0x0FFFFFF8;) {
+            if (c < 2 || c >= cluster_count_ + 2 || chain.size() > cluster_count_)
+                throw std::runtime_error("bad cluster chain at " + std::to_string(first));
+            chain.push_back(c);
+            c = fat_[c];
+        }
+        return chain;
+    }
+
+    // 列出目录（不含 . 、.. 和卷标），有校验和匹配的长文件名时使用长文件名
+    std::vector<Entry> List(uint32_t cluster) const {
+        std::vector<Entry> entries;
+        std::vector<uint8_t> data;
+        for (uint32_t c : Chain(cluster)) {
+            size_t old = data.size();
+            data.resize(old + ClusterSize());
+            volume_.ReadAt(ClusterOffset(c), data.data() + old, ClusterSize());
+        }
+        static const int kLfnOffsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+        std::u16string lfn;
+        int lfn_next = 0;  // 期望的下一个长文件名序号，0 表示没有进行中的长文件名
+        uint8_t lfn_checksum = 0;
+        for (size_t pos = 0; pos + 32 <= data.size(); pos += 32) {
+            const uint8_t* e = data.data() + pos;
+            if (e[0] == 0) break;
+            if (e[0] == 0xE5) {
+                lfn_next = 0;
+                continue;
+            }
+            if (e[11] == kFatAttrLongName) {
+                int ordinal = e[0] & 0x3F;
+                if (e[0] & 0x40) {
+                    lfn.assign(size_t(ordinal) * 13, u'\0');
+                    lfn_checksum = e[13];
+                    lfn_next = ordinal;
+                }
+                if (ordinal == 0 || ordinal != lfn_next || e[13] != lfn_checksum) {
+                    lfn_next = 0;
+                    continue;
+                }
+                for (int j = 0; j < 13; ++j) lfn[size_t(ordinal - 1) * 13 + j] = char16_t(GetLE16(e + kLfnOffsets[j]));
+                lfn_next = ordinal - 1;
+                continue;
+            }
+            bool have_lfn = lfn_next == 0 && !lfn.empty() && FatShortNameChecksum(e) == lfn_checksum;
+            std::u16string long_name = have_lfn ? lfn.substr(0, lfn.find(u'\0')) : u"";
+            lfn.clear();
+            lfn_next = 0;
+            if ((e[11] & kFatAttrVolumeId) || e[0] == '.') continue;
+
+            Entry entry;
+            entry.short_name.assign(reinterpret_cast<const char*>(e), 11);
+            entry.attributes = e[11];
+            entry.first_cluster = (uint32_t(GetLE16(e + 20)) << 16) | GetLE16(e + 26);
+            entry.size = GetLE32(e + 28);
+            if (have_lfn) {
+                entry.name = long_name;
+            } else {
+                auto part = [&](size_t from, size_t len, bool lower) {
+                    std::u16string s;
+                    for (size_t i = from; i < from + len && e[i] != ' '; ++i)
+                        s += char16_t(lower && e[i] >= 'A' && e[i] <= 'Z' ? e[i] + 32 : e[i]);
+                    return s;
+                };
+                entry.name = part(0, 8, e[12] & kFatLowerBase);
+                std::u16string ext = part(8, 3, e[12] & kFatLowerExt);
+                if (!ext.empty()) entry.name += u"." + ext;
+            }
+            entries.push_back(std::move(entry));
+        }
+        return entries;
+    }
+
+private:
+    const VolumeFile& volume_;
+    uint32_t bytes_per_sector_ = 0;
+    uint32_t sectors_per_cluster_ = 0;
+    uint32_t root_cluster_ = 0;
+    uint32_t cluster_count_ = 0;
+    uint64_t data_offset_ = 0;
+    std::vector<uint32_t> fat_;
+};
+
+// 通过读取器回读卷：目录树、名字、大小与簇链必须与布局一致，文件内容按写入时的分块哈希并行比对。
+// 返回出错的路径（为空表示通过）
+std::vector<std::string> VerifyFat32Volume(const VolumeFile& volume, const FatNode& root) {
+    Fat32Reader reader(volume);
+    std::vector<std::string> bad;
+    struct DataCheck {
+        const FatNode* node;
+        uint64_t offset;
+        size_t chunk;
+    };
+    std::vector<DataCheck> checks;
+
+    std::function<void(const FatNode&, uint32_t, const std::string&)> walk = [&](const FatNode& dir, uint32_t cluster,
+                                                                               const std::string& prefix) {
+        std::vector<Fat32Reader::Entry> entries = reader.List(cluster);
+        std::set<std::string> short_names;
+        for (const auto& entry : entries) {
+            if (!short_names.insert(entry.short_name).second) bad.push_back(prefix + " (duplicate short name)");
+        }
+        if (entries.size() != dir.children.size()) bad.push_back(prefix + " (entry count)");
+        for (const auto& child : dir.children) {
+            std::string path = prefix + "/" + fs::path(child->name).string();
+            auto it = std::find_if(entries.begin(), entries.end(),
+                                   [&](const Fat32Reader::Entry& e) { return e.name == child->name; });
+            if (it == entries.end() || it->IsDirectory() != child->is_directory ||
+                (!child->is_directory && it->size != child->size)) {
+                bad.push_back(path);
+                continue;
+            }
+            std::vector<uint32_t> chain = it->first_cluster ? reader.Chain(it->first_cluster) : std::vector<uint32_t>();
+            bool contiguous = chain.size() == child->clusters && (chain.empty() || chain.front() == child->first_cluster);
+            for (size_t k = 1; contiguous && k < chain.size(); ++k) contiguous = chain[k] == chain[k - 1] + 1;
+            if (!contiguous) {
+                bad.push_back(path + " (cluster chain)");
+                continue;
+            }
+            if (child->is_directory) {
+                walk(*child, it->first_cluster, path);
+            } else if (!chain.empty()) {
+                for (size_t k = 0; k < child->chunks.size(); ++k)
+                    checks.push_back({child.get(), reader.ClusterOffset(chain.front()), k});
+            }
+        }
+    };
+    walk(root, reader.RootCluster(), "");
+
+    std::mutex bad_mutex;
+    std::vector<std::vector<uint8_t>> buffers(Executor::Instance().SlotCount());
+    ParallelFor(checks.size(), TaskClass::Io, [&](size_t i, unsigned slot) {
+        const DataCheck& check = checks[i];
+        uint64_t offset = uint64_t(check.chunk) * kVerifyChunkSize;
+        auto& buf = buffers[slot];
+        buf.resize(size_t(std::min<uint64_t>(kVerifyChunkSize, check.node->size - offset)));
+        volume.ReadAt(check.offset + offset, buf.data(), buf.size());
+        if (ComputeSha1(buf.data(), buf.size()) != check.node->chunks[check.chunk]) {
+            std::lock_guard<std::mutex> lock(bad_mutex);
+            bad.push_back(fs::path(check.node->name).string() + " (data)");
+        }
+    });
+    return bad;
+}
+
+// ==================== 远程ISO按需下载 ====================
+
+const uint32_t kIsoSectorSize = 2048;
+const unsigned kDownloadConnections = 6;
+
+// 远程文件上的一段连续字节
+struct RemoteExtent {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+};
+
+// 用curl读取远程文件 [offset, offset+length)；服务器不支持Range时 --max-filesize 会阻止整包下载
+bool HttpReadRange(const std::string& url, uint64_t offset, uint64_t length,
+                   const std::function<void(const uint8_t*, size_t)>& sink) {
+    if (length == 0) return true;
+    std::string cmd = "curl -s -f -L" + CurlRateOption(kDownloadConnections) + " --max-filesize " + std::to_string(length) + " -r " + std::to_string(offset) +
+                      "-" + std::to_string(offset + length - 1) + " \"" + url + "\"";
+    uint64_t received = 0;
+    int rc = execBinary(cmd, [&](const uint8_t* p, size_t n) {
+        if (received + n > length) return false;
+        sink(p, n);
+        received += n;
+        return true;
+    });
+    return rc == 0 && received == length;
+}
+
+std::vector<uint8_t> HttpReadRange(const std::string& url, uint64_t offset, uint64_t length) {
+    std::vector<uint8_t> data;
+    data.reserve(size_t(length));
+    if (!HttpReadRange(url, offset, length, [&](const uint8_t* p, size_t n) { data.insert(data.end(), p, p + n); }))
+        throw std::runtime_error("range request failed: " + std::to_string(offset) + "+" + std::to_string(length));
+    return data;
+}
+
+// 由若干远程区段拼成的逻辑文件（例如ISO中的install.wim）
+class RemoteFile {
+public:
+    RemoteFile(std::string url, std::vector<RemoteExtent> extents) : url_(std::move(url)), extents_(std::move(extents)) {
+        for (const auto& e : extents_) size_ += e.length;
+    }
+
+    uint64_t Size() const { return size_; }
+
+    // 读取逻辑区间，跨区段时拆成多个Range请求
+    bool Read(uint64_t offset, uint64_t length, const std::function<void(const uint8_t*, size_t)>& sink) const {
+        if (offset + length > size_) return false;
+        uint64_t base = 0;
+        for (const auto& e : extents_) {
+            if (length == 0) break;
+            if (offset < base + e.length) {
+                uint64_t within = offset - base;
+                uint64_t n = std::min(length, e.length - within);
+                if (!HttpReadRange(url_, e.offset + within, n, sink)) return false;
+                offset += n;
+                length -= n;
+            }
+            base += e.length;
+        }
+        return length == 0;
+    }
+
+    std::vector<uint8_t> Read(uint64_t offset, uint64_t length) const {
+        std::vector<uint8_t> data;
+        data.reserve(size_t(length));
+        if (!Read(offset, length, [&](const uint8_t* p, size_t n) { data.insert(data.end(), p, p + n); }))
+            throw std::runtime_error("remote read failed");
+        return data;
+    }
+
+private:
+    std::string url_;
+    std::vector<RemoteExtent> extents_;
+    uint64_t size_ = 0;
+};
+
+// 创建指定大小的本地文件；Windows上标记为稀疏文件，只下载部分区间时不必写满整个文件
+void CreateSizedFile(const fs::path& target, uint64_t size) {
+    {
+        std::ofstream create(target, std::ios::binary | std::ios::trunc);
+        if (!create) throw std::runtime_error("cannot create " + target.string());
+    }
+#ifdef _WIN32
+    HANDLE h = CreateFileW(target.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+    if (h != INVALID_HANDLE_VALUE) {
+        DWORD returned = 0;
+        DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returned, nullptr);
+        CloseHandle(h);
+    }
+#endif
+    fs::resize_file(target, size);
+}
+
+// 把远程文件的若干区间分段并行下载到本地文件的相同偏移，失败的分段重试
+void DownloadRemoteRanges(const RemoteFile& remote, const fs::path& target, std::vector<RemoteExtent> ranges,
+                          const std::string& label) {
+    const uint64_t kSegmentSize = 32ull << 20;
+    const uint64_t kMergeGap = 1ull << 20;  // 相距很近的区间合并成一次请求
+    const int kRetries = 3;
+
+    std::sort(ranges.begin(), ranges.end(),
+              [](const RemoteExtent& a, const RemoteExtent& b) { return a.offset < b.offset; });
+    std::vector<RemoteExtent> merged;
+    for (const auto& r : ranges) {
+        if (r.length == 0) continue;
+        if (r.offset + r.length > remote.Size()) throw std::runtime_error("range beyond end of remote file");
+        if (!merged.empty() && r.offset <= merged.back().offset + merged.back().length + kMergeGap) {
+            uint64_t end = std::max(merged.back().offset + merged.back().length, r.offset + r.length);
+            merged.back().length = end - merged.back().offset;
+        } else {
+            merged.push_back(r);
+        }
+    }
+    std::vector<RemoteExtent> segments;
+    uint64_t total = 0;
+    for (const auto& r : merged) {
+        for (uint64_t off = 0; off < r.length; off += kSegmentSize)
+            segments.push_back({r.offset + off, std::min(kSegmentSize, r.length - off)});
+        total += r.length;
+    }
+
+    std::atomic<uint64_t> done{0};
+    std::atomic<int> last_percent{-1};
+    std::mutex print_mutex;
+    std::vector<std::fstream> outputs(Executor::Instance().SlotCount());
+    ParallelFor(segments.size(), TaskClass::Io, [&](size_t i, unsigned worker) {
+        std::fstream& out = outputs[worker];
+        if (!out.is_open()) out.open(target, std::ios::in | std::ios::out | std::ios::binary);
+        const uint64_t offset = segments[i].offset;
+        const uint64_t length = segments[i].length;
+        for (int attempt = 1;; ++attempt) {
+            out.clear();
+            out.seekp(std::streamoff(offset));
+            bool ok = remote.Read(offset, length, [&](const uint8_t* p, size_t n) {
+                out.write(reinterpret_cast<const char*>(p), std::streamsize(n));
+            });
+            if (ok && out) break;
+            if (attempt >= kRetries) throw std::runtime_error("segment download failed at offset " + std::to_string(offset));
+        }
+        uint64_t finished = done += length;
+        int percent = int(finished * 100 / std::max<uint64_t>(total, 1));
+        std::lock_guard<std::mutex> lock(print_mutex);
+        if (percent / 5 > last_percent / 5) {
+            last_percent = percent;
+            std::cout << "[INFO] " << label << " 已下载 " << percent << "%" << std::endl;
+        }
+    }, kDownloadConnections);
+    for (auto& out : outputs) {
+        if (out.is_open()) out.close();
+    }
+}
+
+void DownloadRemoteFile(const RemoteFile& remote, const fs::path& target, const std::string& label) {
+    CreateSizedFile(target, remote.Size());
+    DownloadRemoteRanges(remote, target, {{0, remote.Size()}}, label);
+}
+
+// ISO中的一个文件：名字与它在ISO里的区段
+struct IsoFile {
+    std::string name;
+    bool is_directory = false;
+    std::vector<RemoteExtent> extents;
+    uint64_t Size() const {
+        uint64_t size = 0;
+        for (const auto& e : extents) size += e.length;
+        return size;
     }
+};
 
-// 系统配置结构体
-struct Config {
-    std::string select_mode;
-    std::string image_path;
-    int image_index = 1;  // 默认索引（Windows索引从1开始）
-    bool backup_drive = false;
+bool NameEquals(const std::string& a, const std::string& b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return toupper(uint8_t(x)) == toupper(uint8_t(y)); });
+}
+
+// 只读的UDF解析（Windows安装ISO使用UDF 1.02，其ISO9660部分只有一个README）
+class UdfReader {
+public:
+    explicit UdfReader(const std::string& url) : url_(url) {
+        // 锚点卷描述符指针固定在256扇区
+        auto avdp = ReadSectors(256, 1);
+        if (Tag(avdp.data()) != 2) throw std::runtime_error("no UDF anchor");
+        uint32_t vds_length = GetLE32(avdp.data() + 16);
+        uint32_t vds_location = GetLE32(avdp.data() + 20);
+        auto vds = ReadSectors(vds_location, std::min<uint32_t>(vds_length / kIsoSectorSize, 64));
+
+        uint16_t partition_number = 0;
+        bool have_partition = false, have_volume = false;
+        uint32_t fsd_lbn = 0;
+        uint16_t mapped_partition = 0;
+        for (size_t off = 0; off + kIsoSectorSize <= vds.size(); off += kIsoSectorSize) {
+            const uint8_t* d = vds.data() + off;
+            uint16_t tag = Tag(d);
+            if (tag == 5) {  // 分区描述符
+                partition_number = GetLE16(d + 22);
+                partition_start_ = GetLE32(d + 188);
+                have_partition = true;
+            } else if (tag == 6) {  // 逻辑卷描述符
+                if (GetLE32(d + 212) != kIsoSectorSize) throw std::runtime_error("unsupported UDF block size");
+                fsd_lbn = GetLE32(d + 252);
+                const uint8_t* map = d + 440;
+                if (GetLE32(d + 268) < 1 || map[0] != 1) throw std::runtime_error("unsupported UDF partition map");
+                mapped_partition = GetLE16(map + 4);
+                have_volume = true;
+            } else if (tag == 8) {  // 终止描述符
+                break;
+            }
+        }
+        if (!have_partition || !have_volume || mapped_partition != partition_number)
+            throw std::runtime_error("incomplete UDF volume descriptors");
+
+        auto fsd = ReadSectors(partition_start_ + fsd_lbn, 1);
+        if (Tag(fsd.data()) != 256) throw std::runtime_error("no UDF file set descriptor");
+        root_icb_ = GetLE32(fsd.data() + 404);
+    }
+
+    // 按路径查找文件，路径分量大小写不敏感
+    bool Find(const std::vector<std::string>& path, IsoFile& out) {
+        uint32_t icb = root_icb_;
+        for (size_t i = 0; i < path.size(); ++i) {
+            bool found = false;
+            for (const auto& entry : ReadDirectory(icb)) {
+                if (!NameEquals(entry.first, path[i])) continue;
+                icb = entry.second;
+                found = true;
+                break;
+            }
+            if (!found) return false;
+        }
+        out = ReadFileEntry(icb);
+        out.name = path.empty() ? std::string() : path.back();
+        return true;
+    }
+
+private:
+    static uint16_t Tag(const uint8_t* d) { return GetLE16(d); }
+
+    std::vector<uint8_t> ReadSectors(uint64_t lba, uint32_t count) {
+        return HttpReadRange(url_, lba * kIsoSectorSize, uint64_t(count) * kIsoSectorSize);
+    }
+
+    // 解析文件项，返回数据所在区段（物理偏移）
+    IsoFile ReadFileEntry(uint32_t icb) {
+        auto fe = ReadSectors(partition_start_ + icb, 1);
+        const uint8_t* d = fe.data();
+        uint16_t tag = Tag(d);
+        size_t ad_offset;
+        uint32_t ad_length;
+        if (tag == 261) {  // File Entry
+            ad_offset = 176 + GetLE32(d + 168);
+            ad_length = GetLE32(d + 172);
+        } else if (tag == 266) {  // Extended File Entry
+            ad_offset = 216 + GetLE32(d + 208);
+            ad_length = GetLE32(d + 212);
+        } else {
+            throw std::runtime_error("bad UDF file entry");
+        }
+        if (ad_offset + ad_length > fe.size()) throw std::runtime_error("bad UDF allocation descriptors");
+
+        IsoFile file;
+        file.is_directory = d[16 + 11] == 4;
+        uint64_t size = GetLE64(d + 56);
+        unsigned ad_type = GetLE16(d + 16 + 18) & 7;
+        if (ad_type == 3) {
+            // 内嵌数据：只有小目录会这样存放，直接记录文件项内的位置
+            file.extents.push_back({(partition_start_ + icb) * uint64_t(kIsoSectorSize) + ad_offset, size});
+            return file;
+        }
+        if (ad_type != 0 && ad_type != 1) throw std::runtime_error("unsupported UDF allocation type");
+        const size_t ad_size = ad_type == 0 ? 8 : 16;
+        std::vector<uint8_t> ads(fe.begin() + ad_offset, fe.begin() + ad_offset + ad_length);
+        for (int guard = 0; guard < 1024; ++guard) {
+            bool next_block = false;
+            for (size_t off = 0; off + ad_size <= ads.size(); off += ad_size) {
+                uint32_t raw = GetLE32(ads.data() + off);
+                uint32_t length = raw & 0x3FFFFFFF;
+                uint32_t type = raw >> 30;
+                uint32_t lbn = GetLE32(ads.data() + off + 4);
+                if (length == 0) break;
+                if (type == 3) {  // 描述符续接到另一个扇区
+                    auto aed = ReadSectors(partition_start_ + lbn, 1);
+                    if (Tag(aed.data()) != 258) throw std::runtime_error("bad UDF allocation extent");
+                    uint32_t n = std::min<uint32_t>(GetLE32(aed.data() + 20), kIsoSectorSize - 24);
+                    ads.assign(aed.begin() + 24, aed.begin() + 24 + n);
+                    next_block = true;
+                    break;
+                }
+                if (type == 0) file.extents.push_back({(partition_start_ + uint64_t(lbn)) * kIsoSectorSize, length});
+            }
+            if (!next_block) break;
+        }
+        // 最后一个区段按信息长度截断
+        uint64_t total = 0;
+        for (auto& e : file.extents) {
+            e.length = std::min(e.length, size - total);
+            total += e.length;
+        }
+        if (total != size) throw std::runtime_error("UDF extents do not cover file");
+        return file;
+    }
+
+    // 目录内容：名字 -> 子项文件项位置
+    std::vector<std::pair<std::string, uint32_t>> ReadDirectory(uint32_t icb) {
+        IsoFile dir = ReadFileEntry(icb);
+        if (!dir.is_directory) throw std::runtime_error("not a UDF directory");
+        std::vector<uint8_t> data;
+        for (const auto& e : dir.extents) {
+            auto part = HttpReadRange(url_, e.offset, e.length);
+            data.insert(data.end(), part.begin(), part.end());
+        }
+        std::vector<std::pair<std::string, uint32_t>> entries;
+        for (size_t off = 0; off + 38 <= data.size();) {
+            const uint8_t* d = data.data() + off;
+            if (Tag(d) != 257) break;
+            uint8_t characteristics = d[18];
+            uint8_t name_length = d[19];
+            uint32_t child = GetLE32(d + 24);
+            uint16_t impl_length = GetLE16(d + 36);
+            size_t name_offset = 38 + impl_length;
+            if (off + name_offset + name_length > data.size()) break;
+            if (!(characteristics & 0x0C) && name_length > 0) {  // 跳过父目录与已删除项
+                entries.emplace_back(DecodeName(d + name_offset, name_length), child);
+            }
+            off += (name_offset + name_length + 3) & ~size_t(3);
+        }
+        return entries;
+    }
+
+    // OSTA压缩Unicode：首字节8表示单字节字符，16表示UTF-16BE；这里只需要比较ASCII文件名
+    static std::string DecodeName(const uint8_t* p, size_t n) {
+        std::string name;
+        if (p[0] == 8) {
+            name.assign(reinterpret_cast<const char*>(p + 1), n - 1);
+        } else if (p[0] == 16) {
+            for (size_t i = 1; i + 1 < n; i += 2) {
+                uint16_t c = uint16_t((p[i] << 8) | p[i + 1]);
+                name += c < 0x80 ? char(c) : '?';
+            }
+        }
+        return name;
+    }
+
+    std::string url_;
+    uint64_t partition_start_ = 0;
+    uint32_t root_icb_ = 0;
 };
 
-// 执行命令并检查结果
-void ExecuteCommand(const std::string& cmd) {
-    std::cout << "[EXEC] " << cmd << std::endl;
-    int result = system(cmd.c_str());
-    CHECK(result == 0, "Command failed: " + cmd);
+// ISO9660解析（普通ISO），支持多区段文件
+bool FindIso9660File(const std::string& url, const std::vector<std::string>& path, IsoFile& out) {
+    auto descriptors = HttpReadRange(url, 16ull * kIsoSectorSize, 4ull * kIsoSectorSize);
+    const uint8_t* pvd = nullptr;
+    for (size_t off = 0; off + kIsoSectorSize <= descriptors.size(); off += kIsoSectorSize) {
+        const uint8_t* d = descriptors.data() + off;
+        if (memcmp(d + 1, "CD001", 5) != 0 || d[0] == 255) break;
+        if (d[0] == 1) { pvd = d; break; }
+    }
+    if (!pvd) return false;
+
+    uint32_t extent = GetLE32(pvd + 156 + 2);
+    uint32_t length = GetLE32(pvd + 156 + 10);
+    for (size_t level = 0; level < path.size(); ++level) {
+        auto dir = HttpReadRange(url, uint64_t(extent) * kIsoSectorSize, length);
+        IsoFile match;
+        bool found = false;
+        for (size_t off = 0; off < dir.size();) {
+            uint8_t record_length = dir[off];
+            if (record_length == 0) {  // 记录不跨扇区，跳到下一扇区
+                off = (off / kIsoSectorSize + 1) * kIsoSectorSize;
+                continue;
+            }
+            if (off + record_length > dir.size() || record_length < 34) break;
+            const uint8_t* r = dir.data() + off;
+            uint8_t flags = r[25];
+            std::string name(reinterpret_cast<const char*>(r + 33), r[32]);
+            name = name.substr(0, name.find(';'));
+            if (!name.empty() && name.back() == '.') name.pop_back();
+            if (NameEquals(name, path[level])) {
+                found = true;
+                match.name = name;
+                match.is_directory = (flags & 0x02) != 0;
+                match.extents.push_back({uint64_t(GetLE32(r + 2)) * kIsoSectorSize, GetLE32(r + 10)});
+                if (!(flags & 0x80)) break;  // 没有后续区段
+            }
+            off += record_length;
+        }
+        if (!found) return false;
+        if (level + 1 == path.size()) {
+            out = match;
+            return !out.is_directory;
+        }
+        if (!match.is_directory) return false;
+        extent = uint32_t(match.extents[0].offset / kIsoSectorSize);
+        length = uint32_t(match.extents[0].length);
+    }
+    return false;
 }
 
-// 执行命令行并返回输出
-std::string exec(const char* cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(cmd, "r"), _pclose);
-    if (!pipe) {
-        throw std::runtime_error("popen() failed!");
+// 校验下载得到的镜像：逐个数据流解压并核对查找表中的SHA-1。
+// WIM自带的完整性表可由改动镜像的人一并重算，这里不使用；查找表本身由调用方按预置摘要核对
+bool VerifyDownloadedWim(const fs::path& path) {
+    try {
+        return VerifyWimResources(WimReader(path));
+    } catch (const std::exception& e) {
+        std::cout << "[WARN] 镜像校验出错：" << e.what() << std::endl;
+        return false;
     }
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
+}
+
+// ==================== 远程单镜像提取 ====================
+
+// 从WIM的XML中只保留第 index 个 <IMAGE>，并改为 INDEX="1"；TOTALBYTES 更新为 total_bytes
+std::vector<uint8_t> RewriteWimXmlForImage(const std::vector<uint8_t>& xml, uint32_t index, uint64_t total_bytes) {
+    std::u16string text;
+    size_t start = (xml.size() >= 2 && xml[0] == 0xFF && xml[1] == 0xFE) ? 2 : 0;
+    for (size_t i = start; i + 1 < xml.size(); i += 2) text += char16_t(GetLE16(xml.data() + i));
+    auto u16 = [](const char* s) { return std::u16string(s, s + strlen(s)); };
+
+    std::u16string out;
+    bool found = false;
+    size_t pos = 0;
+    for (;;) {
+        size_t open = text.find(u16("<IMAGE"), pos);
+        if (open == std::u16string::npos) break;
+        size_t tag_end = text.find(u'>', open);
+        size_t close = text.find(u16("</IMAGE>"), open);
+        if (tag_end == std::u16string::npos || close == std::u16string::npos) throw std::runtime_error("bad WIM XML");
+        close += 8;
+        std::u16string tag = text.substr(open, tag_end - open);
+        size_t attr = tag.find(u16("INDEX=\""));
+        uint32_t image = 0;
+        if (attr != std::u16string::npos) {
+            for (size_t i = attr + 7; i < tag.size() && tag[i] >= u'0' && tag[i] <= u'9'; ++i) image = image * 10 + (tag[i] - u'0');
+        }
+        out += text.substr(pos, open - pos);
+        if (image == index) {
+            out += u16("<IMAGE INDEX=\"1\"") + text.substr(tag_end, close - tag_end);
+            found = true;
+        }
+        pos = close;
+    }
+    out += text.substr(pos);
+    if (!found) throw std::runtime_error("image " + std::to_string(index) + " not found in WIM XML");
+
+    size_t total = out.find(u16("<TOTALBYTES>"));
+    size_t total_end = out.find(u16("</TOTALBYTES>"));
+    if (total != std::u16string::npos && total_end != std::u16string::npos && total_end > total)
+        out.replace(total + 12, total_end - total - 12, u16(std::to_string(total_bytes).c_str()));
+
+    std::vector<uint8_t> result = {0xFF, 0xFE};
+    for (char16_t c : out) {
+        result.push_back(uint8_t(c & 0xFF));
+        result.push_back(uint8_t(c >> 8));
     }
     return result;
 }
 
-// 获取文件的MD5哈希
-std::string getFileMD5(const std::string& filePath) {
-    // 构建certutil命令
-    std::string command = "certutil -hashfile \"" + filePath + "\" MD5";
+// 按需读取远程WIM，只下载第 index 个镜像引用到的资源，在 target 写出单镜像WIM
+// 查找表必须与预置的 expected_table 一致，之后下载的每个资源都由表中的SHA-1约束
+void FetchSingleImageWim(const RemoteFile& remote, uint32_t index, const fs::path& target, const std::string& label,
+                         const Sha1Hash& expected_table) {
+    // 先在稀疏的本地镜像中按原偏移填入头部、查找表、XML和所选镜像的元数据
+    fs::path mirror = target;
+    mirror += ".part";
+    CreateSizedFile(mirror, remote.Size());
+    struct RemoveMirror {
+        fs::path path;
+        ~RemoveMirror() {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+    } cleanup{mirror};
 
-    // 执行命令并获取输出
-    std::string output = exec(command.c_str());
+    if (remote.Size() < kWimHeaderSize) throw std::runtime_error("remote WIM too small");
+    std::vector<uint8_t> header = remote.Read(0, kWimHeaderSize);
+    WimResHdr lookup = ParseResHdr(header.data() + 48);
+    WimResHdr xml_res = ParseResHdr(header.data() + 72);
+    DownloadRemoteRanges(remote, mirror,
+                         {{0, kWimHeaderSize}, {lookup.offset, lookup.size_in_wim}, {xml_res.offset, xml_res.size_in_wim}},
+                         label + " 查找表");
 
-    // 从输出中提取MD5哈希值
-    size_t pos = output.find("\n");
-    if (pos != std::string::npos) {
-        size_t endPos = output.find("\n", pos + 1);
-        if (endPos != std::string::npos) {
-            std::string md5 = output.substr(pos + 1, endPos - pos - 1);
-            // 去除可能的空白字符
-            md5.erase(md5.find_last_not_of(" \n\r\t") + 1);
-            return md5;
+    WimReader wim(mirror);
+    if (wim.LookupTableHash() != expected_table) throw std::runtime_error("lookup table does not match the pinned SHA-1");
+    const WimHeader& h = wim.Header();
+    if (h.total_parts != 1) throw std::runtime_error("remote WIM is split");
+    if (index < 1 || index > wim.Metadata().size()) throw std::runtime_error("image index out of range");
+    const WimBlob& metadata = wim.Metadata()[index - 1];
+    DownloadRemoteRanges(remote, mirror, {{metadata.res.offset, metadata.res.size_in_wim}}, label + " 元数据");
+
+    // 所选镜像引用的数据流，引用计数按目录项重新统计
+    std::ifstream in = wim.Open();
+    std::map<Sha1Hash, uint32_t> refs;
+    for (const auto& d : wim.ReadImage(in, index)) {
+        if (!IsZeroHash(d.hash)) refs[d.hash]++;
+        for (const auto& hash : d.named_streams) refs[hash]++;
+    }
+    std::vector<WimBlob> blobs;
+    std::vector<RemoteExtent> ranges;
+    uint64_t all_bytes = 0;
+    for (const auto& blob : wim.Blobs()) all_bytes += blob.res.size_in_wim;
+    for (const auto& ref : refs) {
+        const WimBlob* blob = wim.FindBlob(ref.first);
+        if (!blob) throw std::runtime_error("missing resource " + HashToHex(ref.first));
+        if (blob->res.flags & kResFlagSolid) throw std::runtime_error("solid WIM resources are not supported");
+        blobs.push_back(*blob);
+        blobs.back().ref_count = ref.second;
+        ranges.push_back({blob->res.offset, blob->res.size_in_wim});
+    }
+    std::sort(blobs.begin(), blobs.end(), [](const WimBlob& a, const WimBlob& b) { return a.res.offset < b.res.offset; });
+    uint64_t needed_bytes = 0;
+    for (const auto& r : ranges) needed_bytes += r.length;
+    std::cout << "[INFO] 镜像 " << index << " 引用 " << blobs.size() << "/" << wim.Blobs().size() << " 个数据流，需下载 "
+              << (needed_bytes >> 20) << "/" << (all_bytes >> 20) << " MB" << std::endl;
+    DownloadRemoteRanges(remote, mirror, ranges, label);
+
+    // 写出单镜像WIM：头部、元数据、数据流、查找表、XML
+    WimHeader out_header = h;
+    out_header.image_count = 1;
+    out_header.boot_index = h.boot_index == index ? 1 : 0;
+    out_header.boot_metadata = WimResHdr();
+    out_header.integrity = WimResHdr();
+    std::random_device rd;
+    for (auto& b : out_header.guid) b = uint8_t(rd());
+
+    std::vector<const WimBlob*> resources = {&metadata};
+    for (const auto& blob : blobs) resources.push_back(&blob);
+    std::vector<uint8_t> table(resources.size() * kWimLookupEntrySize);
+    uint64_t offset = kWimHeaderSize;
+    for (size_t i = 0; i < resources.size(); ++i) {
+        WimBlob entry = *resources[i];
+        entry.res.offset = offset;
+        if (i == 0) {
+            entry.ref_count = 1;
+            if (out_header.boot_index) out_header.boot_metadata = entry.res;
         }
+        WriteLookupEntry(table.data() + i * kWimLookupEntrySize, entry);
+        offset += entry.res.size_in_wim;
     }
+    out_header.lookup_table = {table.size(), 0, offset, table.size()};
+    std::vector<uint8_t> xml = RewriteWimXmlForImage(wim.ReadResource(in, h.xml_data), index, offset + table.size());
+    out_header.xml_data = {xml.size(), 0, offset + table.size(), xml.size()};
 
-    return ""; // 如果未找到MD5哈希值，返回空字符串
+    {
+        std::vector<char> out_buffer(8 << 20);
+        std::ofstream out;
+        out.rdbuf()->pubsetbuf(out_buffer.data(), std::streamsize(out_buffer.size()));
+        out.open(target, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("cannot create " + target.string());
+        auto sink = [&](const uint8_t* p, size_t n) { out.write(reinterpret_cast<const char*>(p), std::streamsize(n)); };
+        auto header_bytes = SerializeWimHeader(out_header);
+        sink(header_bytes.data(), header_bytes.size());
+        for (const WimBlob* blob : resources) WimReader::CopyRaw(in, blob->res.offset, blob->res.size_in_wim, sink);
+        sink(table.data(), table.size());
+        sink(xml.data(), xml.size());
+        out.close();
+        if (!out) throw std::runtime_error("write failed: " + target.string());
+    }
+
+    // 结构检查：单镜像、数据流齐全
+    WimReader result(target);
+    if (result.Header().image_count != 1 || result.Metadata().size() != 1 || result.Blobs().size() != blobs.size())
+        throw std::runtime_error("single image WIM does not match source");
+    std::ifstream check = result.Open();
+    for (const auto& d : result.ReadImage(check, 1)) {
+        if (!IsZeroHash(d.hash) && !result.FindBlob(d.hash)) throw std::runtime_error("single image WIM is missing a resource");
+    }
 }
 
-// 文件存在性检查函数
-bool fileExists(const std::string& filename) {
-    std::ifstream file(filename);
-    return file.good();
+// 读取远程WIM的查找表并计算SHA-1，下载前先与预置摘要比对，不一致时不必下载。
+// 只支持未压缩的查找表（dism和wimlib写出的镜像都是如此）
+Sha1Hash RemoteWimTableHash(const RemoteFile& remote) {
+    if (remote.Size() < kWimHeaderSize) throw std::runtime_error("remote WIM too small");
+    std::vector<uint8_t> header = remote.Read(0, kWimHeaderSize);
+    if (memcmp(header.data(), "MSWIM\0\0\0", 8) != 0) throw std::runtime_error("remote file is not a WIM");
+    WimResHdr lookup = ParseResHdr(header.data() + 48);
+    if (lookup.flags & kResFlagCompressed) throw std::runtime_error("compressed lookup table");
+    std::vector<uint8_t> table = remote.Read(lookup.offset, lookup.size_in_wim);
+    return ComputeSha1(table.data(), table.size());
 }
 
-//下载文件
-void downloadAndVerifyFile(
-    const std::string& filename,
-    const std::string& downloadPath,
-    const std::string& expectedMD5
-) {
-    while (true) {
-        // 文件存在性检验
-        if (!fileExists(filename)) {
-            std::cout << "即将开始下载..." << std::endl;
-            std::string cmd = "curl -o \"" + filename + "\" \"" + downloadPath + "\"";
-            std::system(cmd.c_str());
-        } else {
-            std::cout << "文件已存在！\n" << std::endl;
+// 从远程ISO中只下载 sources/install.wim，成功时生成 sources/install.wim。
+// table_sha1 为预置的 install.wim 查找表SHA-1（--tablehash 输出）：没有可信摘要、ISO中只有install.esd
+// 或摘要不一致时返回false，由调用方整包下载ISO并按MD5校验
+bool FetchInstallImageFromIso(Config& config, const std::string& url, const std::string& iso_name,
+                              const std::string& table_sha1) {
+    Sha1Hash pinned;
+    if (!HexToHash(table_sha1, pinned)) {
+        std::cout << "[WARN] 没有预置的 install.wim 摘要，不使用远程按需下载" << std::endl;
+        return false;
+    }
+    std::cout << "下载开始: " << iso_name << "（远程按需读取 install.wim）" << std::endl;
+    try {
+        IsoFile file;
+        std::string found_name;
+        for (const char* name : {"install.wim", "install.esd"}) {
+            std::vector<std::string> path = {"sources", name};
+            bool found = false;
+            try {
+                UdfReader udf(url);
+                found = udf.Find(path, file);
+            } catch (const std::exception&) {
+                found = false;
+            }
+            if (!found) found = FindIso9660File(url, path, file);
+            if (found && !file.is_directory && file.Size() > 0) {
+                found_name = name;
+                break;
+            }
+        }
+        if (found_name.empty()) {
+            std::cout << "[WARN] 远程ISO中未找到 sources/install.wim" << std::endl;
+            return false;
+        }
+        if (found_name == "install.esd") {
+            // ESD为LZMS固实压缩，没有可按预置摘要核对的查找表
+            std::cout << "[WARN] 远程ISO中只有 install.esd，无法按预置摘要校验" << std::endl;
+            return false;
         }
 
-        // MD5验证
-        std::cout << "正在验证镜像MD5..." << std::endl;
-        std::string actualMD5 = getFileMD5(filename);
-        
-        if (actualMD5 == expectedMD5) {
-            std::cout << "MD5验证通过！\n" << std::endl;
-            break;
-        } else {
-            std::cout << "MD5验证未通过，即将重新下载...\n" << std::endl;
-            std::string delCmd = "del \"" + filename + "\"";  // 删除未通过验证的文件
-            std::system(delCmd.c_str());
+        RemoteFile remote(url, file.extents);
+        fs::path target = fs::path("sources") / found_name;
+        std::cout << "[INFO] 远程镜像 " << found_name << " 大小 " << (remote.Size() >> 20) << " MB，共 "
+                  << file.extents.size() << " 个区段" << std::endl;
+        if (RemoteWimTableHash(remote) != pinned) {
+            std::cout << "[WARN] 远程 install.wim 与预置摘要不一致" << std::endl;
+            return false;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&] {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        };
+
+        // 只需要一个版本时，只下载该镜像引用的资源
+        if (config.single_image) {
+            try {
+                FetchSingleImageWim(remote, uint32_t(config.image_index), target, iso_name + " " + found_name, pinned);
+                std::cout << "[INFO] 单镜像下载完成，用时 " << elapsed_ms() << " ms" << std::endl;
+                if (VerifyDownloadedWim(target)) {
+                    // 新WIM中只有这一个镜像，后续挂载与 set.data 使用索引1
+                    config.image_index = 1;
+                    std::cout << iso_name << " 镜像校验通过！（install.wim 查找表与预置SHA-1一致，所选版本的资源已逐个核对）" << std::endl;
+                    return true;
+                }
+                std::cout << "[WARN] 单镜像校验未通过" << std::endl;
+            } catch (const std::exception& e) {
+                std::cout << "[WARN] 单镜像下载失败（" << e.what() << "）" << std::endl;
+            }
+            std::cout << "[WARN] 改为下载完整 install.wim" << std::endl;
+            start = std::chrono::steady_clock::now();
+        }
+
+        DownloadRemoteFile(remote, target, iso_name + " " + found_name);
+        std::cout << "[INFO] 下载完成，用时 " << elapsed_ms() << " ms" << std::endl;
+
+        bool verified = false;
+        try {
+            verified = WimReader(target).LookupTableHash() == pinned && VerifyDownloadedWim(target);
+        } catch (const std::exception& e) {
+            std::cout << "[WARN] 镜像校验出错：" << e.what() << std::endl;
         }
+        if (!verified) {
+            std::cout << "[WARN] 远程镜像校验未通过" << std::endl;
+            fs::remove(target);
+            return false;
+        }
+        std::cout << iso_name << " 镜像校验通过！（install.wim 查找表与预置SHA-1一致，全部资源已逐个核对）" << std::endl;
+        return true;
+    } catch (const std::exception& e) {
+        std::cout << "[WARN] 远程按需下载失败（" << e.what() << "）" << std::endl;
+        std::error_code ec;
+        fs::remove(fs::path("sources") / "install.wim", ec);
+        fs::remove(fs::path("sources") / "install.esd", ec);
+        return false;
     }
 }
 
+// ==================== 阶段日志 ====================
+
+// 源文件的大小与修改时间，作为阶段输入的一部分：同一路径上换了文件时不会误用上次的结果
+std::string FileStamp(const fs::path& path) {
+    std::error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    if (ec) return "-";
+    auto time = fs::last_write_time(path, ec);
+    if (ec) return "-";
+    return std::to_string(size) + ":" + std::to_string(time.time_since_epoch().count());
+}
+
+// 记录已完成的阶段：输入参数、输出文件的大小与分块哈希。
+// 中途失败（例如CHECK直接退出）后重跑时，输入一致且输出仍能通过校验的阶段直接跳过。
+class StageJournal {
+public:
+    explicit StageJournal(fs::path path) : path_(std::move(path)) { Load(); }
+
+    // 阶段已完成、输入一致且输出文件仍然完好
+    bool Done(const std::string& stage, const std::string& key) {
+        const Entry* entry = Find(stage);
+        if (!entry || entry->key != key) return false;
+        for (const auto& file : entry->outputs) {
+            if (verified_.count(file.path.string())) continue;
+            std::error_code ec;
+            if (!IsDevicePath(file.path) && (!fs::exists(file.path, ec) || fs::file_size(file.path, ec) != file.size))
+                return false;
+            try {
+                if (!file.chunks.empty() && !VerifyStagedFiles({file}).empty()) return false;
+            } catch (const std::exception&) {
+                return false;
+            }
+            verified_.insert(file.path.string());
+        }
+        return true;
+    }
+
+    // 阶段记录的输出文件及其分块哈希
+    std::vector<StagedFile> Outputs(const std::string& stage) const {
+        const Entry* entry = Find(stage);
+        return entry ? entry->outputs : std::vector<StagedFile>();
+    }
+
+    // 阶段附带的结果（例如最终使用的镜像索引）
+    std::string Value(const std::string& stage) const {
+        const Entry* entry = Find(stage);
+        return entry ? entry->value : std::string();
+    }
+
+    // 开始（重新）执行某阶段：它和之后的阶段都作废
+    void Begin(const std::string& stage) {
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            if (entries_[i].stage == stage) {
+                entries_.resize(i);
+                break;
+            }
+        }
+        Save();
+    }
+
+    // 阶段完成。之前阶段的同名输出（例如注入驱动后的install.wim）更新为新的哈希
+    void Record(const std::string& stage, const std::string& key, const std::vector<StagedFile>& outputs,
+                const std::string& value = std::string()) {
+        Begin(stage);
+        for (auto& entry : entries_) {
+            for (auto& old : entry.outputs) {
+                for (const auto& file : outputs) {
+                    if (old.path == file.path) old = file;
+                }
+            }
+        }
+        entries_.push_back({stage, key, value, outputs});
+        for (const auto& file : outputs) verified_.insert(file.path.string());
+        Save();
+    }
+
+private:
+    struct Entry {
+        std::string stage;
+        std::string key;
+        std::string value;
+        std::vector<StagedFile> outputs;
+    };
+
+    const Entry* Find(const std::string& stage) const {
+        for (const auto& entry : entries_) {
+            if (entry.stage == stage) return &entry;
+        }
+        return nullptr;
+    }
+
+    // 文本格式，每个阶段一段：stage/key/value/file 行，以 end 结束；
+    // file 行为 "大小 分块哈希(连续十六进制) 路径"。不完整的段视为未完成
+    void Load() {
+        std::ifstream in(path_);
+        std::string line;
+        Entry current;
+        bool open = false;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            size_t space = line.find(' ');
+            std::string tag = line.substr(0, space);
+            std::string rest = space == std::string::npos ? std::string() : line.substr(space + 1);
+            if (tag == "stage") {
+                current = Entry();
+                current.stage = rest;
+                open = true;
+            } else if (!open) {
+                continue;
+            } else if (tag == "key") {
+                current.key = rest;
+            } else if (tag == "value") {
+                current.value = rest;
+            } else if (tag == "file") {
+                StagedFile file;
+                if (!ParseFileLine(rest, file)) break;
+                current.outputs.push_back(file);
+            } else if (tag == "end") {
+                entries_.push_back(current);
+                open = false;
+            }
+        }
+    }
+
+    static bool ParseFileLine(const std::string& text, StagedFile& file) {
+        size_t a = text.find(' ');
+        if (a == std::string::npos) return false;
+        size_t b = text.find(' ', a + 1);
+        if (b == std::string::npos) return false;
+        try {
+            file.size = std::stoull(text.substr(0, a));
+        } catch (const std::exception&) {
+            return false;
+        }
+        std::string hex = text.substr(a + 1, b - a - 1);
+        if (hex == "-") hex.clear();
+        if (hex.size() % 40 != 0) return false;
+        for (size_t i = 0; i < hex.size(); i += 40) {
+            Sha1Hash hash;
+            if (!HexToHash(hex.substr(i, 40), hash)) return false;
+            file.chunks.push_back(hash);
+        }
+        file.path = fs::u8path(text.substr(b + 1));
+        return true;
+    }
+
+    // 先写临时文件并刷盘，再改名替换，断电时旧日志或新日志总有一个完整
+    void Save() const {
+        fs::path temp = path_;
+        temp += ".tmp";
+        {
+            std::ofstream out(temp, std::ios::trunc);
+            for (const auto& entry : entries_) {
+                out << "stage " << entry.stage << "\n";
+                out << "key " << entry.key << "\n";
+                out << "value " << entry.value << "\n";
+                for (const auto& file : entry.outputs) {
+                    std::string hex;
+                    for (const auto& hash : file.chunks) hex += HashToHex(hash);
+                    out << "file " << file.size << " " << (hex.empty() ? "-" : hex) << " " << file.path.u8string() << "\n";
+                }
+                out << "end\n";
+            }
+            out.close();
+            if (!out) throw std::runtime_error("cannot write " + temp.string());
+        }
+        FlushFileToDisk(temp);
+        fs::rename(temp, path_);
+    }
+
+    fs::path path_;
+    std::vector<Entry> entries_;
+    std::set<std::string> verified_;  // 本次运行已校验过的输出，避免同一文件反复回读
+};
+
 // 参数解析
 Config ParseArguments(int argc, char* argv[]) {
     Config config;
@@ -124,6 +3980,35 @@ Config ParseArguments(int argc, char* argv[]) {
             CHECK(i + 1 < argc, "Missing value for --backupdrive");
             std::string value = argv[++i];
             config.backup_drive = (value == "true");
+        } else if (arg == "--remoteiso") {
+            CHECK(i + 1 < argc, "Missing value for --remoteiso");
+            std::string value = argv[++i];
+            config.remote_iso = (value == "true");
+        } else if (arg == "--isourl") {
+            CHECK(i + 1 < argc, "Missing value for --isourl");
+            config.iso_url = argv[++i];
+        } else if (arg == "--singleimage") {
+            CHECK(i + 1 < argc, "Missing value for --singleimage");
+            std::string value = argv[++i];
+            config.single_image = (value == "true");
+        } else if (arg == "--prefetch") {
+            CHECK(i + 1 < argc, "Missing value for --prefetch");
+            std::string value = argv[++i];
+            config.prefetch = (value == "true");
+        } else if (arg == "--ratelimit") {
+            CHECK(i + 1 < argc, "Missing value for --ratelimit");
+            config.rate_limit = argv[++i];
+            CHECK(ParseRateLimit(config.rate_limit, g_rate_limit), "Invalid --ratelimit value: " + config.rate_limit);
+        } else if (arg == "--replay") {
+            CHECK(i + 1 < argc, "Missing value for --replay");
+            std::string script = argv[++i];
+            CHECK(Backend().LoadReplayScript(script), "Invalid replay script: " + script);
+        } else if (arg == "--fat32image") {
+            CHECK(i + 1 < argc, "Missing value for --fat32image");
+            config.fat32_image = argv[++i];
+        } else if (arg == "--peroot") {
+            CHECK(i + 1 < argc, "Missing value for --peroot");
+            Backend().SetPeRoot(argv[++i]);
         }
     }
     
@@ -139,6 +4024,19 @@ Config ParseArguments(int argc, char* argv[]) {
     } else {
         config.image_index = 4;  // 预置模式固定索引4
     }
+    // 卷设备会被锁定、卸载并整卷覆盖，只能是PE分区本身；
+    // 普通文件路径只生成镜像、不写PE分区，真实运行会重启进空的B:，只允许用于回放测试
+    if (!config.fat32_image.empty()) {
+        const std::string device = PeVolumeDevice();
+        if (IsDevicePath(config.fat32_image)) {
+            CHECK(!device.empty() && NameEquals(config.fat32_image, device),
+                  "--fat32image may only target the PE partition " + (device.empty() ? PeRoot().string() : device));
+        } else {
+            CHECK(Backend().Replaying(), "--fat32image must be the PE partition " +
+                                             (device.empty() ? std::string("device") : device) +
+                                             " (image files require --replay)");
+        }
+    }
     
     return config;
 }
@@ -146,6 +4044,8 @@ Config ParseArguments(int argc, char* argv[]) {
 // 处理系统镜像
 void ProcessImage(const Config& config) {
     if (config.select_mode != "custom") {
+        // 远程按需下载已经直接生成了install.wim
+        if (fs::exists("sources/install.wim")) return;
         std::string source_iso = (config.select_mode == "win10") ? "WIN10.iso" : "WIN11.iso";
         CHECK(fs::exists(source_iso), "Missing ISO file: " + source_iso);
         ExecuteCommand("tools\\7z x \"" + source_iso + "\" sources/install.wim -y");
@@ -166,6 +4066,11 @@ void ProcessImage(const Config& config) {
 
 // 准备挂载目录
 void PrepareMountDir() {
+    // 上次运行可能在挂载期间中断，先丢弃残留的挂载
+    if (fs::exists("mount") && !fs::is_empty("mount")) {
+        Backend().Run("dism /unmount-wim /mountdir:mount /discard >nul 2>&1");
+        Backend().Run("dism /cleanup-wim >nul 2>&1");
+    }
     fs::remove_all("mount");
     fs::create_directory("mount");
 }
@@ -183,67 +4088,479 @@ void BackupAndInjectDrivers(const Config& config) {
 }
 
 //下载镜像
-void downloadISO(const Config& config){
+void downloadISO(Config& config){
     std::string fileName = (config.select_mode == "win10") ? "WIN10.iso" : "WIN11.iso";
     std::string downloadPath = (config.select_mode == "win10") ? "win10下载地址" : "win11下载地址";
     std::string fileMd5 = (config.select_mode == "win10") ? "win10的md5" : "win11的md5";
-    if(config.select_mode != "custom") downloadAndVerifyFile(fileName,downloadPath,fileMd5);
+    // ISO中 sources/install.wim 查找表的SHA-1（WinInstaller --tablehash install.wim），用于只下载install.wim时的校验
+    std::string tableSha1 = (config.select_mode == "win10") ? "win10 install.wim查找表的SHA-1" : "win11 install.wim查找表的SHA-1";
+    if(config.select_mode == "custom") return;
+    if(!config.iso_url.empty()) downloadPath = config.iso_url;
+    // 本地没有ISO时先尝试只下载install.wim，失败再整包下载
+    if(config.remote_iso && !fileExists(fileName)){
+        if(FetchInstallImageFromIso(config, downloadPath, fileName, tableSha1)) return;
+        std::cout << "[WARN] 改为下载完整ISO" << std::endl;
+    }
+    downloadAndVerifyFile(fileName,downloadPath,fileMd5);
 }
 //下载PE
 void downloadPE(){
-    std::string fileName = "pe\\boot.wim";
+    std::string fileName = (fs::path("pe") / "boot.wim").string();
     std::string downloadPath = "pe镜像的下载地址";
     std::string fileMd5 = "pe的md5";
     downloadAndVerifyFile(fileName,downloadPath,fileMd5);
 }
 
+// 释放PE镜像到PE分区（或预取时的暂存目录）：优先使用原生WIM引擎，不支持或失败时退回7z
+void ApplyPEImage(const fs::path& target) {
+    const fs::path boot_wim = fs::path("pe") / "boot.wim";
+    std::cout << "[EXEC] native: apply pe\\boot.wim -> " << target.string() << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&] {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    try {
+        WimReader wim(boot_wim);
+        // 多镜像时7z会按索引分目录释放，保持原行为
+        if (wim.Header().image_count != 1) throw std::runtime_error("boot.wim contains multiple images");
+        WimApplyStats stats = ApplyWimImage(wim, 1, target);
+        std::cout << "[INFO] PE释放完成：" << stats.files << " 个文件，" << (stats.bytes >> 20) << " MB（解码 "
+                  << stats.decoded_blobs << " 个数据流，硬链接 " << stats.hard_links << " 个），用时 " << elapsed_ms()
+                  << " ms" << std::endl;
+        if (stats.skipped_reparse > 0)
+            std::cout << "[WARN] 跳过了 " << stats.skipped_reparse << " 个重解析点（原生释放不支持）" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "[WARN] 原生释放失败（" << e.what() << "），改用7z释放" << std::endl;
+        start = std::chrono::steady_clock::now();
+        ExecuteCommand("tools\\7z x pe\\boot.wim -o" + target.string() + " -y");
+        std::cout << "[INFO] 7z释放用时 " << elapsed_ms() << " ms" << std::endl;
+    }
+}
+
+// 记录 root 下由 boot.wim 释放出的文件（不含之后写入的镜像和脚本），作为 pe_apply 与 pe_extract 阶段的输出。
+// boot.wim 不能由原生读取器列出（已改用7z释放）时记录整个目录
+std::vector<StagedFile> RecordPeFiles(const fs::path& root) {
+    std::vector<fs::path> paths;
+    try {
+        WimReader wim(fs::path("pe") / "boot.wim");
+        if (wim.Header().image_count != 1) throw std::runtime_error("boot.wim contains multiple images");
+        std::ifstream in = wim.Open();
+        for (const auto& d : wim.ReadImage(in, 1)) {
+            if (!d.IsDirectory() && !d.IsReparsePoint()) paths.push_back(root / d.path);
+        }
+    } catch (const std::exception&) {
+        paths.clear();
+        for (const auto& e : fs::recursive_directory_iterator(root)) {
+            if (e.is_regular_file()) paths.push_back(e.path());
+        }
+    }
+    return HashFiles(paths);
+}
+
+// 把预取时释放到暂存目录的PE文件复制到PE分区，边复制边计算分块哈希并与 pe_extract 阶段的记录比对。
+// 暂存文件缺失或内容不一致时返回空，由调用方改为从 boot.wim 重新释放
+std::vector<StagedFile> CopyPeStaging(const fs::path& staging, const std::vector<StagedFile>& staged) {
+    std::cout << "[EXEC] native: copy " << staging.string() << " -> " << PeRoot().string() << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<StagedFile> copied;
+    try {
+        // 先按暂存目录建出全部目录（包括空目录），文件之间互不依赖，可以并行复制
+        for (const auto& e : fs::recursive_directory_iterator(staging)) {
+            if (e.is_directory()) fs::create_directories(PeRoot() / e.path().lexically_relative(staging));
+        }
+        std::vector<std::pair<fs::path, fs::path>> pairs;
+        for (const auto& file : staged) pairs.push_back({file.path, PeRoot() / file.path.lexically_relative(staging)});
+        copied = CopyFiles(pairs);
+    } catch (const std::exception& e) {
+        std::cout << "[WARN] 复制预取的PE文件失败（" << e.what() << "），改为重新释放" << std::endl;
+        return {};
+    }
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < staged.size(); ++i) {
+        if (copied[i].size != staged[i].size || copied[i].chunks != staged[i].chunks) {
+            std::cout << "[WARN] 预取的PE文件已改变：" << staged[i].path.string() << "，改为重新释放" << std::endl;
+            return {};
+        }
+        bytes += copied[i].size;
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[INFO] 已复制预取的PE文件：" << copied.size() << " 个文件，" << (bytes >> 20) << " MB，用时 " << ms
+              << " ms" << std::endl;
+    return copied;
+}
+
+// 把install.wim放到PE分区：FAT32放不下单个4GB以上的文件，此时边读边写出.swm分卷
+std::vector<StagedFile> WriteInstallImage(const fs::path& source, const fs::path& target_dir) {
+    fs::create_directories(target_dir);
+    // 清理残留的整包镜像和旧分卷，避免PE端误用
+    std::error_code ec;
+    fs::remove(target_dir / "install.wim", ec);
+    for (size_t i = 1; fs::exists(SwmPartPath(target_dir / "install.swm", i)); ++i)
+        fs::remove(SwmPartPath(target_dir / "install.swm", i), ec);
+
+    if (fs::file_size(source) <= kFat32MaxFileSize) {
+        std::cout << "[EXEC] native: copy sources\\install.wim -> " << (target_dir / "").string() << std::endl;
+        return {CopyFileRecorded(source, target_dir / "install.wim")};
+    }
+    std::cout << "[EXEC] native: split sources\\install.wim -> " << (target_dir / "install*.swm").string() << std::endl;
+    auto parts = WriteSplitWim(source, target_dir / "install.swm", kSwmPartSize);
+    std::cout << "[INFO] install.wim 已分为 " << parts.size() << " 卷" << std::endl;
+    return parts;
+}
+
+// 写入后回读校验，发现坏块时重写一次，仍失败则中止（此时还没有重启进PE）
+std::vector<StagedFile> StageInstallImage() {
+    const fs::path source = fs::path("sources") / "install.wim";
+    const fs::path target_dir = PeRoot() / "sources";
+    for (int attempt = 1;; ++attempt) {
+        std::vector<StagedFile> staged;
+        try {
+            staged = WriteInstallImage(source, target_dir);
+        } catch (const std::exception& e) {
+            CHECK(false, std::string("Failed to stage install.wim: ") + e.what());
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::vector<fs::path> bad;
+        try {
+            bad = VerifyStagedFiles(staged);
+        } catch (const std::exception& e) {
+            CHECK(false, std::string("Failed to verify install.wim: ") + e.what());
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        if (bad.empty()) {
+            std::cout << "[INFO] PE分区镜像校验通过，用时 " << ms << " ms" << std::endl;
+            return staged;
+        }
+        for (const auto& path : bad) std::cout << "[WARN] 校验失败：" << path.string() << std::endl;
+        CHECK(attempt < 2, "Staged install image failed verification");
+        std::cout << "[WARN] 重新写入PE分区镜像..." << std::endl;
+    }
+}
+
+// 执行器扩展性基准（--bench）：用 1..N 个CPU线程依次运行同一负载，输出耗时、吞吐和相对单线程的加速比。
+// workload 为 mem 时对内存中256MB数据按1MB分块计算SHA-1，否则视为WIM文件，解压并校验其中全部资源
+void RunExecutorBenchmark(const std::string& workload) {
+    const size_t kMemBytes = size_t(256) << 20;
+    const size_t kMemChunk = size_t(1) << 20;
+    std::vector<uint8_t> data;
+    std::unique_ptr<WimReader> wim;
+    std::vector<const WimBlob*> blobs;
+    uint64_t bytes = 0;
+    if (workload == "mem") {
+        data.resize(kMemBytes);
+        std::mt19937 rng(1);
+        for (size_t i = 0; i + 4 <= data.size(); i += 4) PutLE32(data.data() + i, uint32_t(rng()));
+        bytes = data.size();
+    } else {
+        wim = std::make_unique<WimReader>(workload);
+        for (const auto& blob : wim->Metadata()) blobs.push_back(&blob);
+        for (const auto& blob : wim->Blobs()) blobs.push_back(&blob);
+        for (const WimBlob* blob : blobs) bytes += blob->res.original_size;
+    }
+
+    const unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < max_threads; n *= 2) counts.push_back(n);
+    counts.push_back(max_threads);
+
+    double base_ms = 0;
+    for (unsigned n : counts) {
+        Executor executor(n, 1, 0);
+        std::vector<std::ifstream> handles(executor.SlotCount());
+        std::atomic<bool> ok{true};
+        auto start = std::chrono::steady_clock::now();
+        if (wim) {
+            ParallelFor(blobs.size(), TaskClass::Cpu, [&](size_t i, unsigned slot) {
+                if (!handles[slot].is_open()) handles[slot].open(wim->Path(), std::ios::binary);
+                Sha1 sha;
+                wim->ReadResource(handles[slot], blobs[i]->res, [&](const uint8_t* p, size_t len) { sha.Update(p, len); });
+                if (sha.Final() != blobs[i]->hash) ok = false;
+            }, 0, TaskPriority::Normal, executor);
+        } else {
+            ParallelFor(data.size() / kMemChunk, TaskClass::Cpu, [&](size_t i, unsigned) {
+                ComputeSha1(data.data() + i * kMemChunk, kMemChunk);
+            }, 0, TaskPriority::Normal, executor);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (n == 1) base_ms = ms;
+        CHECK(ok, "Benchmark workload failed verification: " + workload);
+        std::cout << "[BENCH] threads=" << n << " " << uint64_t(ms) << " ms, "
+                  << uint64_t(bytes / 1048576.0 / std::max(ms, 0.001) * 1000) << " MB/s, speedup "
+                  << std::to_string(base_ms / std::max(ms, 0.001)).substr(0, 4) << "x" << std::endl;
+        executor.Report("threads=" + std::to_string(n));
+    }
+}
+
+// 已写出的卷内容按校验分块计算哈希，作为阶段日志中卷的记录；重跑时按同样的范围回读比对
+StagedFile HashVolumeChunks(const VolumeFile& volume, uint64_t size) {
+    StagedFile file;
+    file.path = volume.Path();
+    file.size = size;
+    file.chunks.resize(size_t((size + kVerifyChunkSize - 1) / kVerifyChunkSize));
+    std::vector<std::vector<uint8_t>> buffers(Executor::Instance().SlotCount());
+    ParallelFor(file.chunks.size(), TaskClass::Io, [&](size_t i, unsigned slot) {
+        uint64_t offset = uint64_t(i) * kVerifyChunkSize;
+        auto& buf = buffers[slot];
+        buf.resize(size_t(std::min<uint64_t>(kVerifyChunkSize, size - offset)));
+        volume.ReadAt(offset, buf.data(), buf.size());
+        file.chunks[i] = ComputeSha1(buf.data(), buf.size());
+    });
+    return file;
+}
+
+// 把PE分区的全部内容（PE文件、install.wim或分卷、set.data、script.cmd、DelPE.cmd）排成一个FAT32卷，
+// 顺序写到 target（镜像文件或 \\.\B: 这样的卷设备），再用读取器回读校验；校验失败时重写一次。
+// 返回卷上已写出部分的分块哈希
+StagedFile BuildPeVolume(const Config& config, const fs::path& target) {
+    const fs::path boot_wim = fs::path("pe") / "boot.wim";
+    const fs::path install_wim = fs::path("sources") / "install.wim";
+    std::cout << "[EXEC] native: build FAT32 volume -> " << target.string() << std::endl;
+    for (int attempt = 1;; ++attempt) {
+        std::vector<std::string> bad;
+        try {
+            auto start = std::chrono::steady_clock::now();
+            WimReader pe(boot_wim);
+            if (pe.Header().image_count != 1) throw std::runtime_error("boot.wim contains multiple images");
+            Fat32Builder builder;
+            builder.AddWimImage(pe, 1);
+
+            // install.wim 超过FAT32单文件上限时按分卷写入，分卷内容边读边生成
+            std::unique_ptr<WimReader> install;
+            std::vector<SwmPart> parts;
+            std::vector<uint8_t> xml;
+            std::ifstream install_in;
+            if (fs::file_size(install_wim) <= kFat32MaxFileSize) {
+                builder.AddLocalFile(fs::path("sources") / "install.wim", install_wim);
+            } else {
+                install = std::make_unique<WimReader>(install_wim);
+                parts = PlanSwmParts(*install, kSwmPartSize);
+                install_in = install->Open();
+                xml = install->ReadResource(install_in, install->Header().xml_data);
+                for (size_t i = 0; i < parts.size(); ++i) {
+                    FatNode* node = builder.AddFile(SwmPartPath(fs::path("sources") / "install.swm", i + 1), parts[i].size);
+                    node->produce = [&, i](const std::function<void(const uint8_t*, size_t)>& sink) {
+                        WriteSwmPart(*install, install_in, xml, parts, i, sink);
+                    };
+                }
+                std::cout << "[INFO] install.wim 将分为 " << parts.size() << " 卷写入" << std::endl;
+            }
+            builder.AddBytes("set.data", std::to_string(config.image_index));
+            builder.AddLocalFile("script.cmd", fs::path("tools") / "script.cmd");
+            builder.AddLocalFile(fs::path("Windows") / "System32" / "DelPE.cmd", fs::path("tools") / "DelPE.cmd");
+
+            VolumeFile volume(target);
+            const Fat32Geometry& g = builder.Layout(volume.DeviceSize(), volume.HiddenSectors());
+            builder.Write(volume, !volume.IsDevice());
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "[INFO] FAT32卷已写出：" << builder.FileCount() << " 个文件，" << (builder.PayloadBytes() >> 20)
+                      << " MB（解码 " << builder.DecodedBlobs() << " 个数据流），簇大小 " << g.ClusterSize() << "，卷大小 " << (uint64_t(g.total_sectors) * kFatSectorSize >> 20)
+                      << " MB，用时 " << ms << " ms" << std::endl;
+
+            start = std::chrono::steady_clock::now();
+            bad = VerifyFat32Volume(volume, builder.Root());
+            ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            if (bad.empty()) {
+                std::cout << "[INFO] FAT32卷校验通过，用时 " << ms << " ms" << std::endl;
+                return HashVolumeChunks(volume, volume.Position());
+            }
+        } catch (const std::exception& e) {
+            CHECK(false, std::string("Failed to build FAT32 volume: ") + e.what());
+        }
+        for (const auto& path : bad) std::cout << "[WARN] 校验失败：" << path << std::endl;
+        CHECK(attempt < 2, "FAT32 volume failed verification");
+        std::cout << "[WARN] 重新写入FAT32卷..." << std::endl;
+    }
+}
+
+// 各阶段耗时，结束时输出 [STAGE] 汇总，便于在回放中比较不同版本的吞吐
+class StageTimer {
+public:
+    void Start(const std::string& stage) {
+        stage_ = stage;
+        start_ = std::chrono::steady_clock::now();
+    }
+
+    void Stop() {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_).count();
+        results_.push_back({stage_, std::to_string(ms) + " ms"});
+    }
+
+    void Skip(const std::string& stage) {
+        std::cout << "[INFO] 阶段 " << stage << " 已完成，跳过" << std::endl;
+        results_.push_back({stage, "skipped"});
+    }
+
+    void Report() const {
+        auto total = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin_).count();
+        for (const auto& result : results_) std::cout << "[STAGE] " << result.first << " " << result.second << std::endl;
+        std::cout << "[STAGE] total " << total << " ms" << std::endl;
+    }
+
+private:
+    std::chrono::steady_clock::time_point begin_ = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point start_;
+    std::string stage_;
+    std::vector<std::pair<std::string, std::string>> results_;
+};
+
+// 安装流程。文件读写、哈希和阶段日志中的错误以异常抛出，由 main 统一报告
+int RunInstaller(int argc, char* argv[]) {
+    // 解析参数（--replay 需要在执行任何命令之前生效）
+    Config config = ParseArguments(argc, argv);
 
-int main(int argc, char* argv[]) {
     // 检查管理员权限
-    CHECK(system("net session >nul 2>&1") == 0, "Require administrator privileges");
-    
+    CHECK(Backend().Run("net session >nul 2>&1") == 0, "Require administrator privileges");
+
+    if (config.prefetch) {
+        EnterBackgroundMode();
+        std::cout << "[INFO] 后台预取模式：低优先级运行" << (config.rate_limit.empty() ? "" : "，限速 " + config.rate_limit)
+                  << std::endl;
+    }
+
+    // 阶段日志：上次中途失败时，从第一个未完成的阶段继续
+    StageJournal journal("install.journal");
+    StageTimer timer;
+    const fs::path install_wim = fs::path("sources") / "install.wim";
+
+    // 执行一个阶段：日志中仍然有效时跳过，否则运行并记录输出；返回是否真正执行
+    auto run_stage = [&](const std::string& stage, const std::string& key, bool valid,
+                         const std::function<std::vector<StagedFile>()>& body) {
+        if (valid && journal.Done(stage, key)) {
+            timer.Skip(stage);
+            return false;
+        }
+        journal.Begin(stage);
+        timer.Start(stage);
+        std::vector<StagedFile> outputs = body();
+        journal.Record(stage, key, outputs, std::to_string(config.image_index));
+        timer.Stop();
+        return true;
+    };
+
     // 创建必要目录
-    fs::remove_all("sources");
-    fs::remove_all("drivers");
-    fs::create_directories("sources");
-    fs::create_directories("drivers");
     fs::create_directories("pe");
-    
+
     //下载PE镜像
-    downloadPE();
+    run_stage("pe", "", true, [&]() -> std::vector<StagedFile> {
+        downloadPE();
+        return {HashFileChunks(fs::path("pe") / "boot.wim")};
+    });
 
-    // 解析参数
-    Config config = ParseArguments(argc, argv);
+    // 下载并处理镜像（结果中记录最终使用的镜像索引）
+    std::string image_key = config.select_mode + "|" + config.image_path + "|" + std::to_string(config.image_index) +
+                            "|" + std::to_string(config.remote_iso) + std::to_string(config.single_image) + "|" +
+                            config.iso_url;
+    if (config.select_mode == "custom") image_key += "|" + FileStamp(config.image_path);
+    bool image_ran = run_stage("image", image_key, true, [&]() -> std::vector<StagedFile> {
+        fs::remove_all("sources");
+        fs::create_directories("sources");
+        downloadISO(config);
+        ProcessImage(config);
+        return {HashFileChunks(install_wim)};
+    });
+    if (!image_ran) config.image_index = std::stoi(journal.Value("image"));
 
-    //下载镜像
-    downloadISO(config);
-    
-    // 处理镜像
-    ProcessImage(config);
-    
     // 驱动操作
-    BackupAndInjectDrivers(config);
+    run_stage("drivers", std::to_string(config.backup_drive), true, [&]() -> std::vector<StagedFile> {
+        fs::remove_all("drivers");
+        fs::create_directories("drivers");
+        BackupAndInjectDrivers(config);
+        // 不注入驱动时install.wim没有变化，沿用镜像阶段记录的哈希，不再整文件重算
+        if (!config.backup_drive) return journal.Outputs("image");
+        return {HashFileChunks(install_wim)};
+    });
+
+    // 预取时把PE提前释放到暂存目录，正式安装时只需复制到PE分区；FAT32卷仍在写卷时从 boot.wim 解码
+    const fs::path pe_staging = fs::path("pe") / "staging";
+    if (config.prefetch && config.fat32_image.empty()) {
+        run_stage("pe_extract", "", true, [&]() -> std::vector<StagedFile> {
+            fs::remove_all(pe_staging);
+            fs::create_directories(pe_staging);
+            ApplyPEImage(pe_staging);
+            return RecordPeFiles(pe_staging);
+        });
+    }
+
+    // 预取到此为止，之后的步骤会修改目标分区，由正式安装时执行
+    if (config.prefetch) {
+        timer.Report();
+        Executor::Instance().Report("total");
+        std::cout << "[SUCCESS] Prefetch completed." << std::endl;
+        return 0;
+    }
 
     // 执行初始化脚本
-    ExecuteCommand("tools\\Rename.cmd");
-    ExecuteCommand("tools\\CreatPE.cmd");
-    
-    // 复制文件到PE分区
-    ExecuteCommand("tools\\7z x pe\\boot.wim -oB:\\");
-    ExecuteCommand("xcopy /y sources\\install.wim B:\\sources\\");
-    
-    // 生成配置文件
-    std::ofstream set_data("B:\\set.data");
-    set_data << config.image_index;
-    set_data.close();
-    
-    // 复制脚本
-    ExecuteCommand("xcopy /y tools\\script.cmd B:\\");
-    ExecuteCommand("xcopy /y tools\\DelPE.cmd B:\\Windows\\System32\\");
+    run_stage("partition", "", fs::exists(PeRoot()), [&]() -> std::vector<StagedFile> {
+        ExecuteCommand("tools\\Rename.cmd");
+        ExecuteCommand("tools\\CreatPE.cmd");
+        return {};
+    });
+
+    if (config.fat32_image.empty()) {
+        // 复制文件到PE分区
+        run_stage("pe_apply", "", true, [&]() -> std::vector<StagedFile> {
+            std::vector<StagedFile> staged = journal.Outputs("pe_extract");
+            if (!staged.empty()) {
+                std::vector<StagedFile> copied = CopyPeStaging(pe_staging, staged);
+                if (!copied.empty()) return copied;
+            }
+            ApplyPEImage(PeRoot());
+            return RecordPeFiles(PeRoot());
+        });
+        run_stage("install", "", true, [&]() { return StageInstallImage(); });
+    } else {
+        // 整个PE分区作为一个FAT32卷顺序写出，配置文件和脚本也在卷中；日志记录卷内容的分块哈希
+        run_stage("fat32", config.fat32_image + "|" + std::to_string(config.image_index), true,
+                  [&]() -> std::vector<StagedFile> { return {BuildPeVolume(config, config.fat32_image)}; });
+    }
+
+    timer.Start("finish");
+    if (config.fat32_image.empty()) {
+        // 生成配置文件
+        std::ofstream set_data(PeRoot() / "set.data");
+        set_data << config.image_index;
+        set_data.close();
+
+        // 复制脚本
+        ExecuteCommand("xcopy /y tools\\script.cmd " + PeRoot().string());
+        ExecuteCommand("xcopy /y tools\\DelPE.cmd " + (PeRoot() / "Windows" / "System32" / "").string());
+    }
     
     // 重启到PE
     ExecuteCommand("tools\\boot.cmd");
+    timer.Stop();
+    timer.Report();
+    Executor::Instance().Report("total");
     
     std::cout << "[SUCCESS] Preparation completed. Rebooting..." << std::endl;
     return 0;
 }
+
+int main(int argc, char* argv[]) {
+    // 输出WIM查找表的SHA-1，用于更新 downloadISO 中预置的摘要
+    if (argc == 3 && std::string(argv[1]) == "--tablehash") {
+        try {
+            std::cout << HashToHex(WimReader(argv[2]).LookupTableHash()) << std::endl;
+        } catch (const std::exception& e) {
+            CHECK(false, std::string("Cannot read WIM: ") + e.what());
+        }
+        return 0;
+    }
+
+    // 执行器基准测试：--bench mem 或 --bench <文件.wim>
+    if (argc == 3 && std::string(argv[1]) == "--bench") {
+        try {
+            RunExecutorBenchmark(argv[2]);
+        } catch (const std::exception& e) {
+            CHECK(false, std::string("Benchmark failed: ") + e.what());
+        }
+        return 0;
+    }
+
+    try {
+        return RunInstaller(argc, argv);
+    } catch (const std::exception& e) {
+        CHECK(false, std::string("Installation failed: ") + e.what());
+    }
+    return EXIT_FAILURE;
+}
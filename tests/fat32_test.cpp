@@ -0,0 +1,138 @@
+// FAT32卷测试：把测试镜像、分卷后的 install.swm 和若干特殊文件名排成一个卷写到文件，
+// 用 VerifyFat32Volume 回读校验，再用 Fat32Reader 释放整棵目录树与期望目录比对；
+// 同一数据流只能解码一次，篡改数据簇后校验必须失败。
+// 期望目录写在 <工作目录>/expected，供 fixtures/fatextract.py 交叉检查 <工作目录>/pe.img。
+//
+//   fat32_test <夹具目录> <工作目录>
+#define main installer_main
+#include "../WinInstaller.cpp"
+#undef main
+#include "test_util.h"
+
+// 只依据卷上的目录项和FAT释放
+static void Extract(const VolumeFile& volume, const Fat32Reader& reader, uint32_t cluster, const fs::path& dir) {
+    fs::create_directories(dir);
+    for (const auto& entry : reader.List(cluster)) {
+        fs::path path = dir / fs::path(entry.name);
+        if (entry.IsDirectory()) {
+            Extract(volume, reader, entry.first_cluster, path);
+            continue;
+        }
+        std::string data;
+        if (entry.first_cluster) {
+            for (uint32_t c : reader.Chain(entry.first_cluster)) {
+                size_t old = data.size();
+                data.resize(old + reader.ClusterSize());
+                volume.ReadAt(reader.ClusterOffset(c), reinterpret_cast<uint8_t*>(&data[old]), reader.ClusterSize());
+            }
+        }
+        EXPECT(data.size() >= entry.size, "short cluster chain: " << path);
+        data.resize(entry.size);
+        WriteAll(path, data);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: fat32_test <fixtures> <work>" << std::endl;
+        return 2;
+    }
+    const fs::path fixtures = argv[1];
+    const fs::path work = argv[2];
+    try {
+        std::error_code ec;
+        fs::remove_all(work, ec);
+        const fs::path expected = work / "expected";
+        fs::create_directories(expected);
+        fs::copy(fixtures / "expected", expected, fs::copy_options::recursive);
+
+        std::cout << "[TEST] build FAT32 volume" << std::endl;
+        Fat32Builder builder;
+        WimReader pe(fixtures / "lzx.wim");
+        builder.AddWimImage(pe, 1);
+
+        // 与 BuildPeVolume 相同，分卷内容边读边生成；参照结果用 WriteSplitWim 写到磁盘
+        WimReader install(fixtures / "multi_lzx.wim");
+        const uint64_t kPartSize = 100000;
+        std::vector<SwmPart> parts = PlanSwmParts(install, kPartSize);
+        std::ifstream install_in = install.Open();
+        std::vector<uint8_t> xml = install.ReadResource(install_in, install.Header().xml_data);
+        for (size_t i = 0; i < parts.size(); ++i) {
+            FatNode* node = builder.AddFile(SwmPartPath(fs::path("sources") / "install.swm", i + 1), parts[i].size);
+            node->produce = [&, i](const std::function<void(const uint8_t*, size_t)>& sink) {
+                WriteSwmPart(install, install_in, xml, parts, i, sink);
+            };
+        }
+        EXPECT(parts.size() > 1, "install.wim was not split");
+        fs::create_directories(expected / "sources");
+        WriteSplitWim(fixtures / "multi_lzx.wim", expected / "sources" / "install.swm", kPartSize);
+
+        // 长文件名、大小写、多个点、Unicode，以及与8.3名字冲突需要 ~N 尾缀的一组文件
+        std::map<std::string, std::string> extras = {
+            {"set.data", "4"},
+            {"Some Long Name With Spaces.txt", "hello"},
+            {"some long name with spaces2.txt", "hello2"},
+            {u8"中文目录/文件名.txt", "unicode"},
+            {"lower.txt", "l"},
+            {"MixedCase.Txt", "m"},
+            {"a.b.c.d", "dots"},
+            {".hidden", "h"},
+            {"empty.bin", ""},
+        };
+        for (int i = 0; i < 12; ++i)
+            extras["many/longfilename_number_" + std::to_string(i) + ".dat"] = std::string(size_t(i) * 700, 'x');
+        for (const auto& [name, data] : extras) {
+            builder.AddBytes(fs::u8path(name), data);
+            WriteAll(expected / fs::u8path(name), data);
+        }
+        builder.AddLocalFile("script.cmd", fixtures / "expected" / "bootmgr");
+        WriteAll(expected / "script.cmd", ReadAll(fixtures / "expected" / "bootmgr"));
+        // 同名文件被替换时保留已有的大小写（与 xcopy /y 相同）
+        builder.AddBytes(fs::path("Windows") / "System32" / "DelPE.cmd", "del");
+        builder.AddBytes(fs::path("windows") / "system32" / "delpe.cmd", "del2");
+        WriteAll(expected / "Windows" / "System32" / "DelPE.cmd", "del2");
+
+        const fs::path image = work / "pe.img";
+        VolumeFile volume(image);
+        const Fat32Geometry& g = builder.Layout(0, 0);
+        builder.Write(volume, true);
+        EXPECT(fs::file_size(image) == uint64_t(g.total_sectors) * kFatSectorSize, "image size");
+
+        // 硬链接和单实例副本共用数据流，每个数据流只解码一次
+        const size_t blobs = DistinctBlobs(fixtures / "expected");
+        EXPECT(builder.DecodedBlobs() == blobs, "decoded " << builder.DecodedBlobs() << " != " << blobs);
+
+        std::cout << "[TEST] verify and extract FAT32 volume" << std::endl;
+        auto bad = VerifyFat32Volume(volume, builder.Root());
+        EXPECT(bad.empty(), "verification failed: " << (bad.empty() ? "" : bad.front()));
+        Fat32Reader reader(volume);
+        Extract(volume, reader, reader.RootCluster(), work / "extracted");
+        ExpectSameTree(expected, work / "extracted");
+
+        std::cout << "[TEST] detect corrupted data cluster" << std::endl;
+        const FatNode* victim = nullptr;
+        for (const auto& child : builder.Root().children)
+            if (!child->is_directory && child->size > 1000) victim = child.get();
+        EXPECT(victim != nullptr, "no file to corrupt");
+        if (victim) {
+            const uint64_t offset = g.ClusterOffset(victim->first_cluster) + 10;
+            uint8_t original = 0, flipped = 0;
+            volume.ReadAt(offset, &original, 1);
+            {
+                std::fstream f(image, std::ios::in | std::ios::out | std::ios::binary);
+                f.seekp(std::streamoff(offset));
+                f.put(char(original ^ 0x5a));
+            }
+            volume.ReadAt(offset, &flipped, 1);
+            EXPECT(flipped != original, "corruption not visible through the volume");
+            EXPECT(!VerifyFat32Volume(volume, builder.Root()).empty(), "corrupted cluster not detected");
+            std::fstream f(image, std::ios::in | std::ios::out | std::ios::binary);
+            f.seekp(std::streamoff(offset));
+            f.put(char(original));
+        }
+    } catch (const std::exception& e) {
+        std::cout << "[FAIL] " << e.what() << std::endl;
+        ++failures;
+    }
+    return TestResult();
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# 独立于 WinInstaller.cpp 的FAT32提取器，用于交叉检查生成的卷：检查引导扇区、两份FAT一致、
+# FSInfo空闲簇数、长文件名校验和、8.3名字不重复、每个文件的簇连续，然后把整棵目录树释放出来。
+#
+#   python3 fatextract.py <卷镜像> <输出目录>
+import struct, sys, os
+img = open(sys.argv[1], 'rb').read()
+out = sys.argv[2]
+bps, spc, res, nf = struct.unpack_from('<HBHB', img, 11)
+tot, fsz = struct.unpack_from('<II', img, 32)
+root, = struct.unpack_from('<I', img, 44)
+assert img[82:90] == b'FAT32   ' and img[510:512] == b'\x55\xaa'
+fat_off = res * bps
+fat = struct.unpack_from('<%dI' % (fsz * bps // 4), img, fat_off)
+assert img[fat_off:fat_off + fsz*bps] == img[fat_off + fsz*bps:fat_off + 2*fsz*bps]
+data = (res + nf * fsz) * bps
+cs = spc * bps
+ncl = (tot - res - nf*fsz) // spc
+assert ncl >= 65525
+fsinfo = img[bps:2*bps]
+assert fsinfo[:4] == b'RRaA' and fsinfo[484:488] == b'rrAa'
+free, = struct.unpack_from('<I', fsinfo, 488)
+used = sum(1 for c in range(2, ncl+2) if fat[c] & 0x0FFFFFFF)
+assert free == ncl - used, (free, ncl, used)
+def chain(c):
+    r = []
+    while 2 <= c < 0x0FFFFFF8:
+        r.append(c); c = fat[c] & 0x0FFFFFFF
+    return r
+def read(c, size=None):
+    b = b''.join(img[data + (x-2)*cs: data + (x-1)*cs] for x in chain(c))
+    return b if size is None else b[:size]
+def walk(c, path, isroot):
+    d = read(c); lfn = {}; names = set(); lfn_sum = None
+    for i in range(0, len(d), 32):
+        e = d[i:i+32]
+        if e[0] == 0: break
+        if e[11] == 0x0f:
+            seq = e[0] & 0x3f
+            lfn_sum = e[13]
+            chars = e[1:11] + e[14:26] + e[28:32]
+            lfn[seq] = chars.decode('utf-16le'); continue
+        if e[11] & 8:
+            assert isroot; lfn = {}; continue
+        nm = e[:11]
+        if nm.startswith(b'.'):
+            lfn = {}; continue
+        base = nm[:8].decode().rstrip(); ext = nm[8:].decode().rstrip()
+        if e[12] & 8: base = base.lower()
+        if e[12] & 0x10: ext = ext.lower()
+        short = base + ('.' + ext if ext else '')
+        s = 0
+        for ch in nm: s = (((s & 1) << 7) + (s >> 1) + ch) & 0xff
+        if lfn:
+            assert lfn_sum == s, 'LFN checksum'
+            name = ''.join(lfn[k] for k in sorted(lfn)).split('\0')[0]
+        else:
+            name = short
+        lfn = {}
+        assert nm not in names; names.add(nm)
+        cl = struct.unpack_from('<H', e, 20)[0] << 16 | struct.unpack_from('<H', e, 26)[0]
+        size, = struct.unpack_from('<I', e, 28)
+        p = os.path.join(path, name)
+        if e[11] & 0x10:
+            os.makedirs(p, exist_ok=True); walk(cl, p, False)
+        else:
+            ch = chain(cl) if cl else []
+            assert ch == list(range(cl, cl + len(ch))), 'fragmented'
+            assert len(ch) == (size + cs - 1) // cs
+            open(p, 'wb').write(read(cl, size) if cl else b'')
+os.makedirs(out, exist_ok=True)
+walk(root, out, True)
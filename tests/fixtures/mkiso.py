@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# 测试用ISO生成器：把给定的WIM作为 sources/install.wim 放进最小的UDF或ISO9660镜像，
+# 覆盖远程按需下载要处理的目录结构（多区段、扩展区段描述符、多extent目录项）。
+#
+#   python3 mkiso.py <install.wim> <输出目录>
+#     udf.iso      UDF，install.wim 分成两个不相邻的区段
+#     udf_aed.iso  同上，第二个区段放在扩展区段描述符（AED）中
+#     plain.iso    只有ISO9660，install.wim 为两个extent的多extent文件
+#     bad.iso      UDF，install.wim 中间有一个字节被篡改
+#     norange.iso  与 udf.iso 相同，rangesrv.py 对路径含 norange 的请求忽略Range
+import shutil, struct, sys
+S = 2048
+
+def sector(n): return bytearray(S*n)
+
+def udf_iso(wim, out, ext_ad=0):
+    # 布局：16 PVD，17 结束符，256 AVDP，257起卷描述符序列（PD、LVD、TD），分区从300扇区开始
+    img=sector(300)
+    pvd=img[16*S:17*S]; pvd[0]=1; pvd[1:6]=b'CD001'
+    img[16*S:17*S]=pvd
+    img[17*S]=255; img[17*S+1:17*S+6]=b'CD001'
+    avdp=bytearray(S); struct.pack_into('<H',avdp,0,2); struct.pack_into('<II',avdp,16,3*S,257)
+    img[256*S:257*S]=avdp
+    P=300
+    pd=bytearray(S); struct.pack_into('<H',pd,0,5); struct.pack_into('<H',pd,22,0); struct.pack_into('<I',pd,188,P)
+    img[257*S:258*S]=pd
+    lvd=bytearray(S); struct.pack_into('<H',lvd,0,6); struct.pack_into('<I',lvd,212,S)
+    struct.pack_into('<II',lvd,248,S,0)  # FSD在分区块0
+    struct.pack_into('<I',lvd,268,1); lvd[440]=1; lvd[441]=6; struct.pack_into('<H',lvd,444,0)
+    img[258*S:259*S]=lvd
+    td=bytearray(S); struct.pack_into('<H',td,0,8); img[259*S:260*S]=td
+    # 分区内块号：0 FSD，1 根目录FE，2 根目录数据，3 sources的EFE，4 sources目录数据，5 install.wim的FE，6 AED，之后是文件数据
+    part=[bytearray(S) for _ in range(8)]
+    fsd=part[0]; struct.pack_into('<H',fsd,0,256); struct.pack_into('<II',fsd,400,S,1)
+    def fid(name, icb, isdir=False, parent=False, unicode=False):
+        if parent: nm=b''
+        elif unicode: nm=b'\x10'+name.encode('utf-16-be')
+        else: nm=b'\x08'+name.encode()
+        f=bytearray(38); struct.pack_into('<H',f,0,257)
+        f[18]=(2 if isdir else 0)|(8 if parent else 0); f[19]=len(nm)
+        struct.pack_into('<II',f,20,S,icb); f+=nm
+        while len(f)%4: f.append(0)
+        return f
+    def fe(ftype, size, ads, adtype=0, ext=False):
+        b=bytearray(S)
+        if ext:
+            struct.pack_into('<H',b,0,266); struct.pack_into('<II',b,208,0,len(ads)); b[216:216+len(ads)]=ads
+        else:
+            struct.pack_into('<H',b,0,261); struct.pack_into('<II',b,168,0,len(ads)); b[176:176+len(ads)]=ads
+        b[27]=ftype; struct.pack_into('<H',b,34,adtype); struct.pack_into('<Q',b,56,size)
+        return b
+    rootdir=fid('',1,True,True)+fid('README.TXT',9)+fid('sources',3,True,unicode=True)
+    part[2][:len(rootdir)]=rootdir
+    part[1]=fe(4,len(rootdir),struct.pack('<II',len(rootdir),2))
+    srcdir=fid('',1,True,True)+fid('boot.wim',9)+fid('install.wim',5)
+    part[4][:len(srcdir)]=srcdir
+    part[3]=fe(4,len(srcdir),struct.pack('<II',len(srcdir),4),ext=True)
+    # install.wim 分成两个区段，中间隔一个填充块
+    first=((len(wim)//2)//S)*S
+    blocks_a=(first+S-1)//S
+    data_start=8
+    lbn_a=data_start; lbn_b=data_start+blocks_a+1
+    rest=len(wim)-first
+    if ext_ad:
+        part[5]=fe(5,len(wim),struct.pack('<II',first,lbn_a)+struct.pack('<II',(3<<30)|S,6))
+        aed=bytearray(S); struct.pack_into('<H',aed,0,258); struct.pack_into('<I',aed,20,8)
+        aed[24:32]=struct.pack('<II',((rest+S-1)//S)*S,lbn_b); part[6]=aed
+    else:
+        part[5]=fe(5,len(wim),struct.pack('<II',first,lbn_a)+struct.pack('<II',((rest+S-1)//S)*S,lbn_b))
+    data=bytearray(S*(blocks_a+1+(rest+S-1)//S))
+    data[0:first]=wim[:first]; data[(blocks_a+1)*S:(blocks_a+1)*S+rest]=wim[first:]
+    for i in range(len(data)//S):
+        if i==blocks_a: data[i*S:(i+1)*S]=b'\xAA'*S
+    img+=b''.join(part)+data
+    open(out,'wb').write(img)
+
+def iso9660(wim, out):
+    img=sector(20)
+    def rec(name, lba, size, flags):
+        nm=name.encode(); r=bytearray(33+len(nm)+(0 if len(nm)%2 else 1))
+        r[0]=len(r); struct.pack_into('<I',r,2,lba); struct.pack_into('>I',r,6,lba)
+        struct.pack_into('<I',r,10,size); struct.pack_into('>I',r,14,size); r[25]=flags; r[32]=len(nm); r[33:33+len(nm)]=nm
+        return r
+    pvd=bytearray(S); pvd[0]=1; pvd[1:6]=b'CD001'
+    pvd[156:156+34]=rec('\0',18,S,2)[:34]
+    img[16*S:17*S]=pvd; img[17*S]=255; img[17*S+1:17*S+6]=b'CD001'
+    first=((len(wim)//3)//S)*S
+    a=20; b=a+first//S+2
+    root=rec('\0',18,S,2)+rec('\1',18,S,2)+rec('README.TXT;1',a,0,0)+rec('SOURCES',19,S,2)
+    img[18*S:18*S+len(root)]=root
+    src=rec('\0',19,S,2)+rec('\1',18,S,2)+rec('INSTALL.WIM;1',a,first,0x80)+rec('INSTALL.WIM;1',b,len(wim)-first,0)
+    img[19*S:19*S+len(src)]=src
+    img+=bytearray((b-a)*S+len(wim)-first+S)
+    img[a*S:a*S+first]=wim[:first]; img[b*S:b*S+len(wim)-first]=wim[first:]
+    open(out,'wb').write(img)
+
+
+if __name__ == '__main__':
+    w = open(sys.argv[1], 'rb').read()
+    out = sys.argv[2]
+    udf_iso(w, out + '/udf.iso')
+    udf_iso(w, out + '/udf_aed.iso', 1)
+    iso9660(w, out + '/plain.iso')
+    bad = bytearray(w); bad[len(w) // 2 + 100] ^= 0xFF
+    udf_iso(bytes(bad), out + '/bad.iso')
+    shutil.copyfile(out + '/udf.iso', out + '/norange.iso')
@@ -0,0 +1,22 @@
+#!/bin/sh
+# 用真实工具生成测试镜像：mkwim.py 的期望目录树（hl1.exe/hl2.exe 改为硬链接）
+# 由 wimlib-imagex 分别以 XPRESS 和 LZX 压缩捕获，写到 tests/fixtures/real/，随仓库提交。
+# wim_apply_test 释放这两个镜像并与期望目录比对，检查解码器与真实压缩器的输出是否兼容。
+#
+#   tests/fixtures/mkreal.sh
+#
+# 在Windows上可用DISM得到等价的镜像（/compress:fast 为XPRESS，/compress:max 为LZX）：
+#   dism /capture-image /imagefile:xpress.wim /capturedir:src /name:real /compress:fast
+#   dism /capture-image /imagefile:lzx.wim /capturedir:src /name:real /compress:max
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+python3 "$here/mkwim.py" "$tmp"
+ln -f "$tmp/expected/Windows/hl1.exe" "$tmp/expected/Windows/hl2.exe"
+mkdir -p "$here/real"
+wimlib-imagex capture "$tmp/expected" "$here/real/xpress.wim" real --compress=XPRESS
+wimlib-imagex capture "$tmp/expected" "$here/real/lzx.wim" real --compress=LZX
+wimlib-imagex info "$here/real/xpress.wim"
+wimlib-imagex info "$here/real/lzx.wim"
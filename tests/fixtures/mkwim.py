@@ -0,0 +1,412 @@
+#!/usr/bin/env python3
+# 测试用WIM生成器：不依赖wimlib/dism，按WIM格式直接写出未压缩、XPRESS、LZX三种镜像，
+# 以及与之对应的期望目录树（expected/）。压缩器只求覆盖解码器的各条分支，不追求压缩率。
+#
+#   python3 mkwim.py <输出目录>            单镜像 none/xpress/lzx.wim、带完整性表的 integrity.wim 与 multi_*.wim
+#   python3 mkwim.py --bench <输出目录> N  N个小文件的XPRESS镜像，用于释放基准
+import struct, hashlib, os, sys, random, heapq, uuid
+
+def huff_lengths(freqs, limit):
+    n = len(freqs)
+    f = [x for x in freqs]
+    while True:
+        syms = [(f[i], i) for i in range(n) if f[i] > 0]
+        lens = [0]*n
+        if not syms: return lens
+        if len(syms) == 1:
+            lens[syms[0][1]] = 1; return lens
+        heap = [(w, i, [s]) for i, (w, s) in enumerate(syms)]
+        heapq.heapify(heap); cnt = len(heap)
+        while len(heap) > 1:
+            w1, _, a = heapq.heappop(heap); w2, _, b = heapq.heappop(heap)
+            for s in a + b: lens[s] += 1
+            cnt += 1; heapq.heappush(heap, (w1 + w2, cnt, a + b))
+        if max(lens) <= limit: return lens
+        f = [(x + 1) // 2 if x else 0 for x in f]
+
+def canon_codes(lens):
+    codes = [0]*len(lens); code = 0
+    for L in range(1, max(lens + [0]) + 1):
+        for s in range(len(lens)):
+            if lens[s] == L: codes[s] = code; code += 1
+        code <<= 1
+    return codes
+
+def find_matches(data, min_len, max_len, max_off):
+    # greedy LZ77 with hash chains
+    items = []; i = 0; n = len(data); table = {}
+    while i < n:
+        best_len = 0; best_off = 0
+        if i + 3 <= n:
+            key = data[i:i+3]
+            for j in reversed(table.get(key, [])[-16:]):
+                off = i - j
+                if off > max_off: continue
+                L = 0
+                while L < max_len and i + L < n and data[j + L] == data[i + L]: L += 1
+                if L > best_len: best_len, best_off = L, off
+            table.setdefault(key, []).append(i)
+        if best_len >= min_len:
+            items.append(('m', best_len, best_off))
+            for k in range(i + 1, min(i + best_len, n - 2)):
+                table.setdefault(data[k:k+3], []).append(k)
+            i += best_len
+        else:
+            items.append(('l', data[i])); i += 1
+    return items
+
+# ---------- XPRESS ----------
+class XpressOut:
+    def __init__(self):
+        self.buf = bytearray(4); self.bits = 0; self.cnt = 0
+        self.nb = 0; self.nb2 = 2
+    def wbits(self, v, n):
+        self.bits = (self.bits << n) | v; self.cnt += n
+        if self.cnt > 16:
+            self.cnt -= 16
+            w = (self.bits >> self.cnt) & 0xFFFF
+            self.buf[self.nb:self.nb+2] = struct.pack('<H', w)
+            self.nb = self.nb2; self.nb2 = len(self.buf); self.buf += b'\0\0'
+            self.bits &= (1 << self.cnt) - 1
+    def wbyte(self, b): self.buf.append(b)
+    def wu16(self, v): self.buf += struct.pack('<H', v)
+    def flush(self):
+        w = (self.bits << (16 - self.cnt)) & 0xFFFF
+        self.buf[self.nb:self.nb+2] = struct.pack('<H', w)
+        self.buf[self.nb2:self.nb2+2] = b'\0\0'
+        return bytes(self.buf)
+
+def xpress_compress(data):
+    items = find_matches(data, 3, 65535 + 3, 65535)
+    syms = []
+    freqs = [0]*512
+    for it in items:
+        if it[0] == 'l': s = it[1]
+        else:
+            L, off = it[1], it[2]
+            lo = off.bit_length() - 1
+            s = 256 + (lo << 4) + min(L - 3, 15)
+        freqs[s] += 1; syms.append((s, it))
+    freqs[256] = max(freqs[256], 0)
+    lens = huff_lengths(freqs, 15); codes = canon_codes(lens)
+    table = bytes((lens[2*i] | (lens[2*i+1] << 4)) for i in range(256))
+    os_ = XpressOut()
+    for s, it in syms:
+        os_.wbits(codes[s], lens[s])
+        if it[0] == 'm':
+            L, off = it[1], it[2]; lo = off.bit_length() - 1; adj = L - 3
+            if adj >= 15:
+                b1 = min(adj - 15, 255); os_.wbyte(b1)
+                if b1 == 255: os_.wu16(adj)
+            os_.wbits(off - (1 << lo), lo)
+    return table + os_.flush()
+
+# ---------- LZX ----------
+class LzxOut:
+    def __init__(self): self.out = bytearray(); self.bits = 0; self.cnt = 0
+    def wbits(self, v, n):
+        for k in range(n - 1, -1, -1):
+            self.bits = (self.bits << 1) | ((v >> k) & 1); self.cnt += 1
+            if self.cnt == 16:
+                self.out += struct.pack('<H', self.bits); self.bits = 0; self.cnt = 0
+    def align(self):
+        if self.cnt: self.wbits(0, 16 - self.cnt)
+    def raw(self, b): assert self.cnt == 0; self.out += b
+
+def e8_translate(data):
+    d = bytearray(data); n = len(d); i = 0
+    if n <= 10: return bytes(d)
+    while i < n - 10:
+        if d[i] == 0xE8:
+            rel = struct.unpack_from('<i', d, i + 1)[0]
+            if -i <= rel < 12000000:
+                ab = rel + i if rel < 12000000 - i else rel - 12000000
+                struct.pack_into('<i', d, i + 1, ab)
+            i += 5
+        else: i += 1
+    return bytes(d)
+
+def lzx_slots(window):
+    extra = []; base = []; b = 0
+    for s in range(50):
+        e = 0 if s < 4 else min(17, (s - 2) // 2); extra.append(e); base.append(b); b += 1 << e
+    nslots = sum(1 for x in base if x < window)
+    return extra, base, nslots
+
+def lzx_write_lens(os_, new, old):
+    pres = [(old[i] - new[i]) % 17 for i in range(len(new))]
+    # use run-length of zeros (17/18) when possible to exercise those paths
+    seq = []; i = 0
+    while i < len(new):
+        if new[i] == 0 and old[i] == 0:
+            j = i
+            while j < len(new) and new[j] == 0 and j - i < 51: j += 1
+            run = j - i
+            if run >= 20: seq.append((18, run - 20, 5)); i = j; continue
+            if run >= 4: seq.append((17, run - 4, 4)); i = j; continue
+        if i + 4 <= len(new) and len(set(new[i:i+4])) == 1 and len(set(old[i:i+4])) == 1 and new[i] != 0:
+            seq.append((19, 0, 1, pres[i])); i += 4; continue
+        seq.append((pres[i],)); i += 1
+    freqs = [0]*20
+    for e in seq:
+        freqs[e[0]] += 1
+        if e[0] == 19: freqs[e[3]] += 1
+    pl = huff_lengths(freqs, 15); pc = canon_codes(pl)
+    for L in pl: os_.wbits(L, 4)
+    for e in seq:
+        os_.wbits(pc[e[0]], pl[e[0]])
+        if e[0] in (17, 18): os_.wbits(e[1], e[2])
+        elif e[0] == 19:
+            os_.wbits(e[1], 1); os_.wbits(pc[e[3]], pl[e[3]])
+
+def lzx_compress(data, chunk_size, rng):
+    extra, base, nslots = lzx_slots(max(chunk_size, 32768))
+    nmain = 256 + 8 * nslots
+    t = e8_translate(data)
+    os_ = LzxOut()
+    main_old = [0]*nmain; len_old = [0]*249
+    recent = [1, 1, 1]
+    pos = 0
+    can_raw = True
+    while pos < len(t):
+        bsize = min(len(t) - pos, rng.choice([32768, 1000, 5000, 7777]))
+        btype = rng.choice([1, 2, 3]) if can_raw else rng.choice([1, 2])
+        block = t[pos:pos + bsize]
+        os_.wbits(btype, 3)
+        if bsize == 32768: os_.wbits(1, 1)
+        else: os_.wbits(0, 1); os_.wbits(bsize, 16)
+        if btype == 3:
+            if os_.cnt == 0: os_.wbits(0, 16)
+            os_.align()
+            os_.raw(struct.pack('<III', *recent)); os_.raw(block)
+            if bsize & 1: os_.raw(b'\0')
+            pos += bsize; continue
+        can_raw = False
+        # 匹配可以引用本块之前的数据；偏移随机挑选，目的是覆盖解码器的各条路径而不是压缩率
+        items = []
+        i = pos
+        hist = t
+        while i < pos + bsize:
+            best = (0, 0)
+            for off in set([recent[0], recent[1], recent[2]] + [rng.randint(1, i) for _ in range(8)] if i > 0 else []):
+                if off > i: continue
+                L = 0
+                while L < 257 and i + L < pos + bsize and hist[i + L - off] == hist[i + L]: L += 1
+                if L > best[0]: best = (L, off)
+            if best[0] >= 2:
+                items.append(('m', best[0], best[1])); i += best[0]
+            else:
+                items.append(('l', hist[i])); i += 1
+        toks = []
+        mf = [0]*nmain; lf = [0]*249; af = [0]*8
+        for it in items:
+            if it[0] == 'l':
+                toks.append((it[1],)); mf[it[1]] += 1; continue
+            L, off = it[1], it[2]
+            if off in recent:
+                slot = recent.index(off)
+                recent[slot] = recent[0]; recent[0] = off
+                ext = None
+            else:
+                adj = off + 2
+                slot = max(s for s in range(3, nslots) if base[s] <= adj)
+                ext = (adj - base[slot], extra[slot])
+                recent[2] = recent[1]; recent[1] = recent[0]; recent[0] = off
+            lh = min(L - 2, 7)
+            ms = 256 + slot * 8 + lh
+            mf[ms] += 1
+            if lh == 7: lf[L - 2 - 7] += 1
+            if ext and btype == 2 and ext[1] >= 3: af[ext[0] & 7] += 1
+            toks.append((ms, L, ext))
+        ml = huff_lengths(mf, 16); mc = canon_codes(ml)
+        ll = huff_lengths(lf, 16); lc = canon_codes(ll)
+        al = huff_lengths(af, 7) if btype == 2 else [0]*8; ac = canon_codes(al)
+        if btype == 2:
+            for L in al: os_.wbits(L, 3)
+        lzx_write_lens(os_, ml[:256], main_old[:256])
+        lzx_write_lens(os_, ml[256:], main_old[256:])
+        lzx_write_lens(os_, ll, len_old)
+        main_old = ml; len_old = ll
+        for tk in toks:
+            os_.wbits(mc[tk[0]], ml[tk[0]])
+            if len(tk) == 1: continue
+            ms, L, ext = tk
+            if (ms - 256) & 7 == 7: os_.wbits(lc[L - 9], ll[L - 9])
+            if ext:
+                v, nb = ext
+                if btype == 2 and nb >= 3:
+                    os_.wbits(v >> 3, nb - 3); os_.wbits(ac[v & 7], al[v & 7])
+                else:
+                    os_.wbits(v, nb)
+        pos += bsize
+    os_.align()
+    return bytes(os_.out)
+
+# ---------- WIM writer ----------
+def reshdr(size, flags, off, orig):
+    return struct.pack('<Q', size | (flags << 56)) + struct.pack('<QQ', off, orig)
+
+def compress_resource(data, ctype, chunk, rng):
+    if ctype is None or len(data) == 0: return data, False
+    chunks = []
+    for i in range(0, len(data), chunk):
+        c = data[i:i+chunk]
+        z = xpress_compress(c) if ctype == 'xpress' else lzx_compress(c, chunk, rng)
+        chunks.append(z if len(z) < len(c) else c)
+    esz = 8 if len(data) > 0xFFFFFFFF else 4
+    offs = []; o = 0
+    for c in chunks[:-1]: o += len(c); offs.append(o)
+    table = b''.join(struct.pack('<I' if esz == 4 else '<Q', x) for x in offs)
+    return table + b''.join(chunks), True
+
+def u16(s): return s.encode('utf-16-le')
+
+def dentry(name, attrs, subdir, hash_, hlink=0, streams=()):
+    nm = u16(name)
+    fixed = struct.pack('<QIiQQQQQQ', 0, attrs, -1, subdir, 0, 0, 1, 2, 3) + hash_ + struct.pack('<IQHHH', 0, hlink, len(streams), 0, len(nm))
+    body = fixed + nm + (b'\0\0' if nm else b'')
+    length = len(body)
+    body = struct.pack('<Q', length) + body[8:]
+    body += b'\0' * ((8 - len(body) % 8) % 8)
+    for sname, shash in streams:
+        snm = u16(sname)
+        e = struct.pack('<QQ', 0, 0) + shash + struct.pack('<H', len(snm)) + snm + (b'\0\0' if snm else b'')
+        e = struct.pack('<Q', len(e)) + e[8:]
+        e += b'\0' * ((8 - len(e) % 8) % 8)
+        body += e
+    return body
+
+# 树结构：目录为dict，文件为 ('f', 数据, 硬链接组)，重解析点为 ('r', 数据, 标记)
+# 名字以S开头的文件额外带一个命名数据流 ads
+def build_metadata(tree, blobs):
+    out = bytearray(struct.pack('<II', 8, 0))
+    def add_blob(data):
+        h = hashlib.sha1(data).digest() if data else b'\0'*20
+        if data: blobs[h] = data
+        return h
+    def add_dir(d):
+        # 先排同级目录项（子目录偏移留空），再递归写子目录并回填
+        start = len(out)
+        pos = []
+        for n in sorted(d):
+            v = d[n]
+            pos.append((len(out), v))
+            if isinstance(v, dict):
+                out.extend(dentry(n, 0x10, 0, b'\0'*20))
+            elif v[0] == 'r':
+                out.extend(dentry(n, 0x420, 0, add_blob(v[1]), v[2]))
+            elif v[2] == 0 and n.startswith('S'):
+                ads = v[1][::-1] + b'ads'
+                out.extend(dentry(n, 0x20, 0, b'\0'*20, 0, streams=[('', add_blob(v[1])), ('ads', add_blob(ads))]))
+            else:
+                out.extend(dentry(n, 0x20, 0, add_blob(v[1]), v[2]))
+        out.extend(b'\0'*8)
+        for p, v in pos:
+            if isinstance(v, dict) and v:
+                struct.pack_into('<Q', out, p + 16, add_dir(v))
+        return start
+    root_pos = len(out)
+    out.extend(dentry('', 0x10, 0, b'\0'*20)); out.extend(b'\0'*8)
+    struct.pack_into('<Q', out, root_pos + 16, add_dir(tree))
+    return bytes(out)
+
+def write_wim(path, trees, ctype, chunk=32768, seed=1, boot=1, integrity=False):
+    rng = random.Random(seed)
+    flags = {None: 0, 'xpress': 0x2 | 0x20000, 'lzx': 0x2 | 0x40000}[ctype]
+    f = bytearray(208)
+    def add_res(data, rflags):
+        z, comp = compress_resource(data, ctype, chunk, rng)
+        off = len(f); f.extend(z)
+        return reshdr(len(z), rflags | (4 if comp else 0), off, len(data))
+    blobs = {}
+    metas = [build_metadata(t, blobs) for t in trees]
+    entries = [add_res(m, 2) + struct.pack('<HI', 1, 1) + hashlib.sha1(m).digest() for m in metas]
+    for h, data in blobs.items():
+        entries.append(add_res(data, 0) + struct.pack('<HI', 1, 1) + h)
+    lt = b''.join(entries)
+    lt_off = len(f); f.extend(lt)
+    images = ''.join('<IMAGE INDEX="%d"><NAME>Edition %d</NAME></IMAGE>' % (i + 1, i + 1) for i in range(len(trees)))
+    xml = ('\ufeff<WIM><TOTALBYTES>0</TOTALBYTES>' + images + '</WIM>').encode('utf-16-le')
+    xml_off = len(f); f.extend(xml)
+    # 完整性表覆盖头部之后到查找表末尾，按10MB分块
+    integ = reshdr(0,0,0,0)
+    if integrity:
+        step = 10 << 20
+        hashes = [hashlib.sha1(f[i:min(i + step, lt_off + len(lt))]).digest() for i in range(208, lt_off + len(lt), step)]
+        table = struct.pack('<III', 12 + 20 * len(hashes), len(hashes), step) + b''.join(hashes)
+        integ = reshdr(len(table), 0, len(f), len(table)); f.extend(table)
+    hdr = b'MSWIM\0\0\0' + struct.pack('<III', 208, 0x10d00, flags) + struct.pack('<I', chunk if ctype else 0) + uuid.uuid4().bytes + struct.pack('<HHI', 1, 1, len(trees))
+    hdr += reshdr(len(lt), 0, lt_off, len(lt)) + reshdr(len(xml), 0, xml_off, len(xml)) + reshdr(0,0,0,0) + struct.pack('<I', boot) + integ
+    hdr += b'\0' * (208 - len(hdr))
+    f[0:208] = hdr
+    open(path, 'wb').write(f)
+
+# ---------- fixtures ----------
+def make_tree(seed):
+    rng = random.Random(seed)
+    def rnd(n): return bytes(rng.getrandbits(8) for _ in range(n))
+    def text(n):
+        words = [b'Windows', b'System32', b'\xe8\x01\x02\x03\x04', b'driver', b'boot', b' ', b'\n', b'config']
+        out = bytearray()
+        while len(out) < n: out += rng.choice(words)
+        return bytes(out[:n])
+    shared = text(50000)
+    linked = ('f', text(70001), 7)
+    return {
+        'Windows': {
+            'System32': {
+                'a.dll': ('f', text(100000), 0),
+                'b.dll': ('f', rnd(40000) + text(30000), 0),
+                'empty.txt': ('f', b'', 0),
+                'dup1.bin': ('f', shared, 0),
+                'Sstream.bin': ('f', text(777), 0),
+                '中文.txt': ('f', text(5000), 0),
+            },
+            'hl1.exe': linked,
+            'hl2.exe': linked,
+            'dup2.bin': ('f', shared, 0),
+            'emptydir': {},
+            'junction': ('r', b'\x03\x00\x00\xa0' + text(60), 0xA0000003),
+        },
+        'bootmgr': ('f', text(65536), 0),
+        'tiny': ('f', b'x', 0),
+    }
+
+def make_bench_tree(count, seed=7):
+    rng = random.Random(seed)
+    words = [b'Windows', b'System32', b'\xe8\x01\x02\x03\x04', b'driver', b'boot', b' ', b'\n', b'config']
+    tree = {}
+    for i in range(count):
+        data = bytearray()
+        while len(data) < 4096 + (i * 7919) % 12288: data += rng.choice(words)
+        tree.setdefault('d%02d' % (i % 32), {})['f%05d.sys' % i] = ('f', bytes(data), 0)
+    return tree
+
+def dump_tree(tree, root):
+    os.makedirs(root, exist_ok=True)
+    for n, v in tree.items():
+        p = os.path.join(root, n)
+        if isinstance(v, dict):
+            dump_tree(v, p)
+        elif v[0] == 'f':
+            open(p, 'wb').write(v[1])
+
+if __name__ == '__main__':
+    if sys.argv[1] == '--bench':
+        out, count = sys.argv[2], int(sys.argv[3])
+        tree = make_bench_tree(count)
+        dump_tree(tree, os.path.join(out, 'bench_expected'))
+        write_wim(os.path.join(out, 'bench.wim'), [tree], 'xpress')
+        sys.exit(0)
+    out = sys.argv[1]
+    tree = make_tree(42)
+    dump_tree(tree, os.path.join(out, 'expected'))
+    for c in [None, 'xpress', 'lzx']:
+        write_wim(os.path.join(out, '%s.wim' % (c or 'none')), [tree], c)
+    write_wim(os.path.join(out, 'integrity.wim'), [tree], None, integrity=True)
+    # 三个版本共享大部分数据流，第二个版本多一个文件
+    t2 = make_tree(42); t2['pro.dll'] = ('f', bytes(random.Random(5).getrandbits(8) for _ in range(60000)), 0)
+    t3 = make_tree(42); t3['edu.bin'] = ('f', bytes(random.Random(6).getrandbits(8) for _ in range(400000)), 0)
+    dump_tree(t2, os.path.join(out, 'expected2'))
+    write_wim(os.path.join(out, 'multi_lzx.wim'), [tree, t2, t3], 'lzx', seed=3, boot=0)
+    write_wim(os.path.join(out, 'multi_xpress.wim'), [tree, t2, t3], 'xpress', seed=3, boot=0)
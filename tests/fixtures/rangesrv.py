@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+# 测试用HTTP服务器：支持单段Range请求；路径中含 norange 时忽略Range、总是返回整个文件，
+# 模拟不支持Range的服务器。
+#
+#   python3 rangesrv.py <目录>    监听127.0.0.1上的随机端口，启动后把端口号打印到标准输出
+import http.server, os, re, sys
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def do_GET(self):
+        path = os.path.join(sys.argv[1], self.path.lstrip('/'))
+        if not os.path.isfile(path):
+            self.send_error(404); return
+        data = open(path, 'rb').read()
+        m = re.match(r'bytes=(\d+)-(\d+)', self.headers.get('Range', ''))
+        if m and 'norange' not in self.path:
+            a, b = int(m[1]), min(int(m[2]), len(data) - 1)
+            chunk = data[a:b + 1]
+            self.send_response(206)
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (a, b, len(data)))
+        else:
+            chunk = data
+            self.send_response(200)
+        self.send_header('Content-Length', str(len(chunk)))
+        self.end_headers()
+        try:
+            self.wfile.write(chunk)
+        except (BrokenPipeError, ConnectionResetError):
+            pass  # curl 遇到 --max-filesize 会提前断开
+
+    def log_message(self, *args):
+        pass
+
+server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), Handler)
+print(server.server_address[1], flush=True)
+server.serve_forever()
@@ -0,0 +1,73 @@
+// 远程按需下载测试：从本地HTTP服务器上的测试ISO（UDF、UDF+AED、ISO9660）只下载 install.wim，
+// 检查与原镜像逐字节一致；篡改的镜像、与预置摘要不一致的镜像、没有预置摘要、不支持Range的服务器
+// 和不存在的地址必须返回失败以便退回整包下载。
+// 单镜像模式下载第2个版本，释放后与期望目录树比对。
+//
+//   remote_iso_test <夹具目录> <HTTP地址前缀> <工作目录>
+#define main installer_main
+#include "../WinInstaller.cpp"
+#undef main
+#include "test_util.h"
+
+// 测试ISO中的 install.wim 都由 multi_lzx.wim 生成
+static std::string pinned;
+
+static bool Fetch(Config& config, const std::string& base, const std::string& name, const std::string& pin = pinned) {
+    std::error_code ec;
+    fs::remove_all("sources", ec);
+    fs::create_directories("sources");
+    std::cout << "[TEST] fetch " << name << (config.single_image ? " (single image)" : "") << std::endl;
+    return FetchInstallImageFromIso(config, base + "/" + name, name, pin);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4) {
+        std::cerr << "usage: remote_iso_test <fixtures> <base-url> <work>" << std::endl;
+        return 2;
+    }
+    const fs::path fixtures = fs::absolute(argv[1]);
+    const std::string base = argv[2];
+    fs::create_directories(argv[3]);
+    fs::current_path(argv[3]);
+    try {
+        const std::string original = ReadAll(fixtures / "multi_lzx.wim");
+        pinned = HashToHex(WimReader(fixtures / "multi_lzx.wim").LookupTableHash());
+        const std::string other = HashToHex(WimReader(fixtures / "multi_xpress.wim").LookupTableHash());
+        Config config;
+        config.single_image = false;
+        for (const char* name : {"udf.iso", "udf_aed.iso", "plain.iso"}) {
+            EXPECT(Fetch(config, base, name), name << ": fetch failed");
+            EXPECT(ReadAll(fs::path("sources") / "install.wim") == original, name << ": install.wim differs");
+        }
+        for (const char* name : {"bad.iso", "norange.iso", "missing.iso"}) {
+            EXPECT(!Fetch(config, base, name), name << ": should fall back to full download");
+            EXPECT(!fs::exists(fs::path("sources") / "install.wim"), name << ": partial install.wim left behind");
+        }
+        // 内容自洽但不是预置的镜像，以及没有预置摘要时都不能接受
+        EXPECT(!Fetch(config, base, "udf.iso", other), "substituted install.wim accepted");
+        EXPECT(!Fetch(config, base, "udf.iso", "win10 install.wim查找表的SHA-1"), "fetch without a pinned digest");
+        EXPECT(!fs::exists(fs::path("sources") / "install.wim"), "install.wim left behind after digest mismatch");
+
+        // 只下载第2个版本引用的资源，生成的WIM只含这一个镜像，索引改为1
+        config.single_image = true;
+        config.image_index = 2;
+        EXPECT(Fetch(config, base, "udf.iso"), "single image fetch failed");
+        EXPECT(config.image_index == 1, "image index not reset: " << config.image_index);
+        WimReader wim(fs::path("sources") / "install.wim");
+        EXPECT(wim.Header().image_count == 1, "image count " << wim.Header().image_count);
+        EXPECT(fs::file_size(fs::path("sources") / "install.wim") < original.size(), "single image not smaller");
+        std::error_code ec;
+        fs::remove_all("applied", ec);
+        ApplyWimImage(wim, 1, "applied");
+        ExpectSameTree(fixtures / "expected2", "applied");
+
+        config.image_index = 2;
+        EXPECT(!Fetch(config, base, "bad.iso"), "single image from bad.iso accepted");
+        config.image_index = 2;
+        EXPECT(!Fetch(config, base, "udf.iso", other), "single image from substituted install.wim accepted");
+    } catch (const std::exception& e) {
+        std::cout << "[FAIL] " << e.what() << std::endl;
+        ++failures;
+    }
+    return TestResult();
+}
@@ -0,0 +1,155 @@
+#!/bin/sh
+# 回放测试：在干净的目录中生成 pe/boot.wim、tools 下的脚本和自定义镜像，按 replay.txt 模拟外部命令
+# 跑完整安装流程（普通流程、重复运行、预取后安装、--fat32image），检查 [STAGE] 输出与PE分区的内容。
+#
+#   tests/replay/run_replay.sh [工作目录] [已生成的夹具目录]
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+repo=$(cd "$here/../.." && pwd)
+work=${1:-/tmp/wininstaller-replay}
+CXX=${CXX:-g++}
+rm -rf "$work" && mkdir -p "$work"
+$CXX -std=c++17 -O2 -pthread "$repo/WinInstaller.cpp" -o "$work/wininstaller"
+fixtures=${2:-$work/fixtures}
+[ -f "$fixtures/lzx.wim" ] || python3 "$repo/tests/fixtures/mkwim.py" "$fixtures"
+image="$fixtures/multi_lzx.wim"
+
+fail() {
+    echo "[FAIL] $*"
+    exit 1
+}
+
+# 运行目录：PE镜像用单镜像测试WIM代替，脚本内容任意
+setup() {
+    rm -rf "$1" && mkdir -p "$1/pe" "$1/tools"
+    cp "$fixtures/lzx.wim" "$1/pe/boot.wim"
+    printf '@echo off\r\nrem install\r\n' > "$1/tools/script.cmd"
+    printf '@echo off\r\nrem delete PE\r\n' > "$1/tools/DelPE.cmd"
+    cp "$here/replay.txt" "$1/replay.txt"
+    cd "$1"
+}
+
+# expect_stages 日志 阶段:ran|skipped ...，只允许出现列出的阶段
+expect_stages() {
+    log=$1
+    shift
+    grep -q "^\[SUCCESS\]" "$log" || fail "$log: no [SUCCESS] line"
+    count=0
+    for item in "$@"; do
+        stage=${item%%:*}
+        line=$(grep "^\[STAGE\] $stage " "$log") || fail "$log: missing stage $stage"
+        case ${item#*:} in
+        ran) echo "$line" | grep -q " ms$" || fail "$log: $stage should run: $line" ;;
+        skipped) echo "$line" | grep -q " skipped$" || fail "$log: $stage should be skipped: $line" ;;
+        esac
+        count=$((count + 1))
+    done
+    [ "$(grep -c '^\[STAGE\]' "$log")" -eq $((count + 1)) ] || fail "$log: unexpected stages"
+    grep "^\[STAGE\]" "$log"
+}
+
+# PE分区（目录或提取出的FAT32卷）中应有的文件；第二个参数为应当写入的镜像，默认 $image
+expect_pe_content() {
+    cmp "$1/sources/install.wim" "${2:-$image}" || fail "$1: install.wim differs"
+    [ "$(cat "$1/set.data")" = 2 ] || fail "$1: set.data"
+    cmp "$1/script.cmd" tools/script.cmd || fail "$1: script.cmd"
+    cmp "$1/Windows/System32/DelPE.cmd" tools/DelPE.cmd || fail "$1: DelPE.cmd"
+    cmp "$1/bootmgr" "$fixtures/expected/bootmgr" || fail "$1: PE image not applied"
+}
+
+echo "[TEST] replay: full run"
+setup "$work/run"
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot > full.log 2>&1 ||
+    fail "full run failed: $(tail -1 full.log)"
+expect_stages full.log pe:ran image:ran drivers:ran partition:ran pe_apply:ran install:ran finish:ran
+expect_pe_content peroot
+
+echo "[TEST] replay: rerun skips completed stages"
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot > rerun.log 2>&1 ||
+    fail "rerun failed: $(tail -1 rerun.log)"
+expect_stages rerun.log pe:skipped image:skipped drivers:skipped partition:skipped pe_apply:skipped install:skipped finish:ran
+
+echo "[TEST] replay: PE files deleted after a successful run"
+find peroot -mindepth 1 -maxdepth 1 ! -name sources ! -name set.data ! -name script.cmd ! -name Windows -exec rm -rf {} +
+find peroot/Windows -type f ! -name DelPE.cmd -delete
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot > deleted.log 2>&1 ||
+    fail "run after deleting PE files failed: $(tail -1 deleted.log)"
+expect_stages deleted.log pe:skipped image:skipped drivers:skipped partition:skipped pe_apply:ran install:ran finish:ran
+expect_pe_content peroot
+
+echo "[TEST] replay: image replaced at the same path"
+setup "$work/swap"
+cp "$image" my.wim
+"$work/wininstaller" --select custom --path my.wim --set 2 --replay replay.txt --peroot peroot > first.log 2>&1 ||
+    fail "first run failed: $(tail -1 first.log)"
+cp "$fixtures/multi_xpress.wim" my.wim
+"$work/wininstaller" --select custom --path my.wim --set 2 --replay replay.txt --peroot peroot > swap.log 2>&1 ||
+    fail "run after swap failed: $(tail -1 swap.log)"
+expect_stages swap.log pe:skipped image:ran drivers:ran partition:ran pe_apply:ran install:ran finish:ran
+expect_pe_content peroot my.wim
+
+echo "[TEST] replay: prefetch extracts PE, install copies it"
+setup "$work/prefetch"
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot --prefetch true > prefetch.log 2>&1 ||
+    fail "prefetch failed: $(tail -1 prefetch.log)"
+expect_stages prefetch.log pe:ran image:ran drivers:ran pe_extract:ran
+[ ! -e peroot ] || fail "prefetch touched the PE partition"
+cmp pe/staging/bootmgr "$fixtures/expected/bootmgr" || fail "PE not extracted to pe/staging"
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot > install.log 2>&1 ||
+    fail "install after prefetch failed: $(tail -1 install.log)"
+expect_stages install.log pe:skipped image:skipped drivers:skipped partition:ran pe_apply:ran install:ran finish:ran
+grep -q "已复制预取的PE文件" install.log || fail "staged PE files not copied"
+! grep -q "native: apply pe" install.log || fail "boot.wim decoded again after prefetch"
+expect_pe_content peroot
+
+echo "[TEST] replay: damaged PE staging falls back to boot.wim"
+printf 'XXXX' | dd of=pe/staging/bootmgr bs=1 seek=100 conv=notrunc 2>/dev/null
+rm -rf peroot
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot > restage.log 2>&1 ||
+    fail "install with damaged staging failed: $(tail -1 restage.log)"
+expect_stages restage.log pe:skipped image:skipped drivers:skipped partition:ran pe_apply:ran install:ran finish:ran
+grep -q "native: apply pe" restage.log || fail "damaged staging was used"
+expect_pe_content peroot
+
+echo "[TEST] replay: --fat32image"
+setup "$work/fat32"
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot --fat32image pe.img > fat32.log 2>&1 ||
+    fail "fat32 run failed: $(tail -1 fat32.log)"
+expect_stages fat32.log pe:ran image:ran drivers:ran partition:ran fat32:ran finish:ran
+python3 "$repo/tests/fixtures/fatextract.py" pe.img volume
+expect_pe_content volume
+
+echo "[TEST] replay: --fat32image rerun and damaged volume"
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot --fat32image pe.img > fat32_rerun.log 2>&1 ||
+    fail "fat32 rerun failed: $(tail -1 fat32_rerun.log)"
+expect_stages fat32_rerun.log pe:skipped image:skipped drivers:skipped partition:skipped fat32:skipped finish:ran
+printf 'XXXX' | dd of=pe.img bs=1 seek=$(($(stat -c %s pe.img) / 2)) conv=notrunc 2>/dev/null
+"$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot --fat32image pe.img > fat32_damaged.log 2>&1 ||
+    fail "fat32 run after damage failed: $(tail -1 fat32_damaged.log)"
+expect_stages fat32_damaged.log pe:skipped image:skipped drivers:skipped partition:skipped fat32:ran finish:ran
+rm -rf volume && python3 "$repo/tests/fixtures/fatextract.py" pe.img volume
+expect_pe_content volume
+
+echo "[TEST] replay: plain-file --fat32image without --replay is rejected"
+if "$work/wininstaller" --select custom --path "$image" --set 2 --fat32image pe.img > noreplay.log 2>&1; then
+    fail "plain-file --fat32image accepted"
+fi
+grep -q "^\[ERROR\] --fat32image" noreplay.log || fail "unexpected error: $(tail -1 noreplay.log)"
+
+echo "[TEST] replay: --fat32image on a volume other than the PE partition is rejected"
+for peroot in 'B:\' peroot; do
+    if "$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot "$peroot" --fat32image '\\.\D:' > otherdev.log 2>&1; then
+        fail "--fat32image \\\\.\\D: accepted with --peroot $peroot"
+    fi
+    grep -q "^\[ERROR\] --fat32image may only target the PE partition" otherdev.log || fail "unexpected error: $(tail -1 otherdev.log)"
+done
+
+echo "[TEST] replay: missing pe/boot.wim"
+setup "$work/missing"
+rm pe/boot.wim
+if "$work/wininstaller" --select custom --path "$image" --set 2 --replay replay.txt --peroot peroot > missing.log 2>&1; then
+    fail "run without pe/boot.wim succeeded"
+fi
+grep -q "^\[ERROR\] Download failed" missing.log || fail "unexpected error: $(tail -1 missing.log)"
+
+echo "[PASS] replay"
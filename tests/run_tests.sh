@@ -0,0 +1,52 @@
+#!/bin/sh
+# 在Linux上生成测试夹具、编译并运行全部测试：
+#   tests/run_tests.sh [工作目录]          运行测试
+#   tests/run_tests.sh --bench [文件数]     生成小文件镜像，比较原生释放与7z释放的耗时
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++17 -O2 -g -Wall -Wextra -pthread}
+
+build() {
+    $CXX $CXXFLAGS "$here/$1.cpp" -o "$work/$1"
+}
+
+if [ "$1" = "--bench" ]; then
+    work=${WORK:-/tmp/wininstaller-bench}
+    rm -rf "$work" && mkdir -p "$work"
+    python3 "$here/fixtures/mkwim.py" --bench "$work" "${2:-500}"
+    build wim_apply_test
+    "$work/wim_apply_test" --bench "$work/bench.wim" "$work/out"
+    exit 0
+fi
+
+work=${1:-/tmp/wininstaller-tests}
+rm -rf "$work" && mkdir -p "$work"
+python3 "$here/fixtures/mkwim.py" "$work/fixtures"
+# 真实工具生成的镜像（fixtures/mkreal.sh）随仓库提交，缺少时 wim_apply_test 跳过对应用例
+if [ -d "$here/fixtures/real" ]; then cp -r "$here/fixtures/real" "$work/fixtures/real"; fi
+
+build wim_apply_test
+"$work/wim_apply_test" "$work/fixtures" "$work/apply"
+
+build verify_test
+"$work/verify_test" "$work/fixtures" "$work/verify"
+
+# FAT32卷：内置读取器校验后，再用独立的Python提取器交叉检查
+build fat32_test
+"$work/fat32_test" "$work/fixtures" "$work/fat32"
+python3 "$here/fixtures/fatextract.py" "$work/fat32/pe.img" "$work/fat32/py"
+diff -r "$work/fat32/expected" "$work/fat32/py"
+
+# 完整安装流程回放
+"$here/replay/run_replay.sh" "$work/replay" "$work/fixtures"
+
+# 远程按需下载：本地HTTP服务器提供测试ISO
+mkdir -p "$work/iso"
+python3 "$here/fixtures/mkiso.py" "$work/fixtures/multi_lzx.wim" "$work/iso"
+python3 "$here/fixtures/rangesrv.py" "$work/iso" > "$work/port" &
+server=$!
+trap 'kill $server 2>/dev/null' EXIT
+while [ ! -s "$work/port" ]; do sleep 0.1; done
+build remote_iso_test
+"$work/remote_iso_test" "$work/fixtures" "http://127.0.0.1:$(cat "$work/port")" "$work/remote"
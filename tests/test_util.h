@@ -0,0 +1,55 @@
+// 测试程序共用的断言与文件工具，在 #include "../WinInstaller.cpp" 之后包含。
+// 断言失败只计数不中止，最后由 TestResult 输出 [PASS]/[FAIL] 并给出退出码。
+#pragma once
+
+#include <set>
+
+inline int failures = 0;
+
+#define EXPECT(cond, msg)                                                   \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            std::cout << "[FAIL] " << __LINE__ << ": " << msg << std::endl; \
+            ++failures;                                                     \
+        }                                                                   \
+    } while (0)
+
+inline std::string ReadAll(const fs::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+inline void WriteAll(const fs::path& path, const std::string& data) {
+    fs::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::binary).write(data.data(), std::streamsize(data.size()));
+}
+
+// 两棵目录树的路径集合、文件/目录类型与文件内容必须完全一致
+inline void ExpectSameTree(const fs::path& expected, const fs::path& actual) {
+    std::set<fs::path> want, got;
+    for (const auto& e : fs::recursive_directory_iterator(expected)) want.insert(fs::relative(e.path(), expected));
+    for (const auto& e : fs::recursive_directory_iterator(actual)) got.insert(fs::relative(e.path(), actual));
+    for (const auto& p : want) {
+        if (!got.count(p)) {
+            EXPECT(false, "missing " << p);
+        } else if (fs::is_directory(expected / p)) {
+            EXPECT(fs::is_directory(actual / p), p << " is not a directory");
+        } else {
+            EXPECT(ReadAll(expected / p) == ReadAll(actual / p), "content differs: " << p);
+        }
+    }
+    for (const auto& p : got) EXPECT(want.count(p), "unexpected " << p);
+}
+
+// 期望树中内容不同的非空文件数，即应当解码的数据流数
+inline size_t DistinctBlobs(const fs::path& expected) {
+    std::set<std::string> blobs;
+    for (const auto& e : fs::recursive_directory_iterator(expected))
+        if (e.is_regular_file() && e.file_size() > 0) blobs.insert(ReadAll(e.path()));
+    return blobs.size();
+}
+
+inline int TestResult() {
+    std::cout << (failures ? "[FAIL] " : "[PASS] ") << failures << " failure(s)" << std::endl;
+    return failures ? 1 : 0;
+}
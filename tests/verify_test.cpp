@@ -0,0 +1,114 @@
+// 写后校验测试：SHA-1标准向量与吞吐、复制时记录的分块哈希、回读校验对篡改的检测（含WIM完整性表）。
+//
+//   verify_test <夹具目录> <工作目录>
+#define main installer_main
+#include "../WinInstaller.cpp"
+#undef main
+#include "test_util.h"
+
+#include <random>
+
+static std::string Sha1Hex(const std::string& data) { return HashToHex(ComputeSha1(data.data(), data.size())); }
+
+static void Corrupt(const fs::path& path, uint64_t offset) {
+    std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+    f.seekg(std::streamoff(offset));
+    char c = char(f.get());
+    f.seekp(std::streamoff(offset));
+    f.put(char(c ^ 0x5a));
+}
+
+static void TestSha1() {
+    std::cout << "[TEST] sha1 vectors" << std::endl;
+    EXPECT(Sha1Hex("") == "da39a3ee5e6b4b0d3255bfef95601890afd80709", "empty");
+    EXPECT(Sha1Hex("abc") == "a9993e364706816aba3e25717850c26c9cd0d89d", "abc");
+    EXPECT(Sha1Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+               "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+           "two blocks");
+    EXPECT(Sha1Hex(std::string(1000000, 'a')) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f", "million a");
+
+    // 任意切分的增量更新与一次性计算一致
+    std::mt19937 rng(1);
+    std::string data(100000, '\0');
+    for (auto& c : data) c = char(rng());
+    const Sha1Hash whole = ComputeSha1(data.data(), data.size());
+    for (int round = 0; round < 20; ++round) {
+        Sha1 sha;
+        size_t pos = 0;
+        while (pos < data.size()) {
+            size_t n = std::min<size_t>(data.size() - pos, rng() % 200);
+            sha.Update(data.data() + pos, n);
+            pos += n;
+        }
+        EXPECT(sha.Final() == whole, "split update round " << round);
+    }
+
+    const size_t kBenchBytes = size_t(64) << 20;
+    std::vector<uint8_t> buf(kBenchBytes, 0x5a);
+    auto start = std::chrono::steady_clock::now();
+    volatile uint8_t sink = ComputeSha1(buf.data(), buf.size())[0];
+    (void)sink;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "[BENCH] sha1: " << std::fixed << std::setprecision(0) << (kBenchBytes >> 20) / seconds << " MB/s"
+              << std::endl;
+}
+
+static void TestCopyAndVerify(const fs::path& fixtures, const fs::path& work) {
+    std::cout << "[TEST] copy with chunk hashes" << std::endl;
+    fs::create_directories(work);
+    // 跨三个校验分块，最后一块不满
+    const fs::path source = work / "source.bin";
+    std::string data(size_t(kVerifyChunkSize) * 2 + 12345, '\0');
+    std::mt19937 rng(2);
+    for (auto& c : data) c = char(rng());
+    std::ofstream(source, std::ios::binary).write(data.data(), std::streamsize(data.size()));
+
+    StagedFile copy = CopyFileRecorded(source, work / "copy.bin");
+    EXPECT(copy.size == data.size(), "size " << copy.size);
+    EXPECT(copy.chunks.size() == 3, "chunks " << copy.chunks.size());
+    for (size_t i = 0; i < copy.chunks.size(); ++i) {
+        size_t offset = i * kVerifyChunkSize;
+        size_t length = std::min<size_t>(kVerifyChunkSize, data.size() - offset);
+        EXPECT(copy.chunks[i] == ComputeSha1(data.data() + offset, length), "chunk " << i);
+    }
+    {
+        std::ifstream in(work / "copy.bin", std::ios::binary);
+        EXPECT(std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()) == data, "copy differs");
+    }
+
+    std::cout << "[TEST] verify staged files" << std::endl;
+    const fs::path integrity = work / "integrity.wim";
+    fs::copy_file(fixtures / "integrity.wim", integrity, fs::copy_options::overwrite_existing);
+    StagedFile wim;
+    wim.path = integrity;
+    std::vector<StagedFile> files = {copy, wim};
+    EXPECT(VerifyStagedFiles(files).empty(), "clean files reported bad");
+
+    Corrupt(work / "copy.bin", kVerifyChunkSize + 7);
+    auto bad = VerifyStagedFiles(files);
+    EXPECT(bad.size() == 1 && bad[0] == copy.path, "corrupted copy not detected");
+
+    Corrupt(integrity, 5000);
+    bad = VerifyStagedFiles(files);
+    EXPECT(bad.size() == 2, "corrupted integrity.wim not detected");
+
+    fs::resize_file(work / "copy.bin", data.size() - 1);
+    bad = VerifyStagedFiles({copy});
+    EXPECT(bad.size() == 1, "truncated copy not detected");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "usage: verify_test <fixtures> <work>" << std::endl;
+        return 2;
+    }
+    try {
+        TestSha1();
+        TestCopyAndVerify(argv[1], argv[2]);
+    } catch (const std::exception& e) {
+        std::cout << "[FAIL] " << e.what() << std::endl;
+        ++failures;
+    }
+    Executor::Instance().Report("test");
+    return TestResult();
+}
@@ -0,0 +1,202 @@
+// 原生WIM释放测试：释放 none/xpress/lzx 三种测试镜像，逐字节比对目录树并检查硬链接；
+// 把多镜像WIM分卷后再拼回单个WIM释放，检查分卷中的资源位置；
+// 夹具目录中有 real/（fixtures/mkreal.sh 用 wimlib-imagex 生成）时，同样释放真实工具压缩的镜像；
+// 另有基准模式，同一镜像分别用原生引擎和7z释放并比较耗时。
+//
+//   wim_apply_test <夹具目录> <工作目录>
+//   wim_apply_test --bench <镜像.wim> <工作目录>
+#define main installer_main
+#include "../WinInstaller.cpp"
+#undef main
+#include "test_util.h"
+
+#include <cstdlib>
+
+static WimApplyStats Apply(const fs::path& wim_path, uint32_t index, const fs::path& target) {
+    std::error_code ec;
+    fs::remove_all(target, ec);
+    WimReader wim(wim_path);
+    return ApplyWimImage(wim, index, target);
+}
+
+static void TestApply(const fs::path& fixtures, const fs::path& work) {
+    const fs::path expected = fixtures / "expected";
+    size_t expected_files = 0;
+    uint64_t expected_bytes = 0;
+    for (const auto& e : fs::recursive_directory_iterator(expected)) {
+        if (!e.is_regular_file()) continue;
+        ++expected_files;
+        expected_bytes += e.file_size();
+    }
+    const uint64_t linked_size = fs::file_size(expected / "Windows" / "hl1.exe");
+
+    for (const char* name : {"none", "xpress", "lzx"}) {
+        std::cout << "[TEST] apply " << name << ".wim" << std::endl;
+        const fs::path target = work / name;
+        WimApplyStats stats = Apply(fixtures / (std::string(name) + ".wim"), 1, target);
+        ExpectSameTree(expected, target);
+        EXPECT(fs::equivalent(target / "Windows" / "hl1.exe", target / "Windows" / "hl2.exe"), name << ": hl1/hl2 not linked");
+        EXPECT(fs::hard_link_count(target / "Windows" / "hl1.exe") == 2, name << ": wrong link count");
+        EXPECT(!fs::equivalent(target / "Windows" / "dup2.bin", target / "Windows" / "System32" / "dup1.bin"),
+               name << ": single-instance copies must not be linked");
+        EXPECT(stats.files == expected_files, name << ": files " << stats.files << " != " << expected_files);
+        EXPECT(stats.hard_links == 1, name << ": hard_links " << stats.hard_links);
+        EXPECT(stats.decoded_blobs == DistinctBlobs(expected), name << ": decoded " << stats.decoded_blobs);
+        EXPECT(stats.bytes == expected_bytes - linked_size, name << ": bytes " << stats.bytes);
+        EXPECT(stats.skipped_reparse == 1, name << ": skipped_reparse " << stats.skipped_reparse);
+    }
+
+    // 多镜像：第二个版本与第一个共享数据流，只多一个文件
+    for (const char* name : {"multi_lzx", "multi_xpress"}) {
+        std::cout << "[TEST] apply " << name << ".wim index 2" << std::endl;
+        const fs::path target = work / name;
+        Apply(fixtures / (std::string(name) + ".wim"), 2, target);
+        ExpectSameTree(fixtures / "expected2", target);
+    }
+
+    // 数据流被篡改时必须报错而不是写出错误内容（文件中部是未压缩的数据流）
+    std::cout << "[TEST] apply corrupted none.wim" << std::endl;
+    const fs::path corrupt = work / "corrupt.wim";
+    fs::copy_file(fixtures / "none.wim", corrupt, fs::copy_options::overwrite_existing);
+    {
+        std::fstream f(corrupt, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(std::streamoff(fs::file_size(corrupt) / 2));
+        f.put('\x5a');
+    }
+    bool threw = false;
+    try {
+        Apply(corrupt, 1, work / "corrupt");
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    EXPECT(threw, "corrupted resource was accepted");
+}
+
+// 把分卷重新拼成单个WIM：资源按各分卷自己的查找表原样复制，不经过分卷的规划与写出代码
+static void MergeSwm(const std::vector<fs::path>& parts, const fs::path& target) {
+    WimReader first(parts[0]);
+    WimHeader header = first.Header();
+    std::ofstream out(target, std::ios::binary | std::ios::trunc);
+    std::vector<uint8_t> placeholder(kWimHeaderSize);
+    out.write(reinterpret_cast<const char*>(placeholder.data()), std::streamsize(placeholder.size()));
+    auto sink = [&](const uint8_t* p, size_t n) { out.write(reinterpret_cast<const char*>(p), std::streamsize(n)); };
+
+    std::vector<uint8_t> table;
+    uint64_t offset = kWimHeaderSize;
+    auto copy = [&](std::ifstream& in, const WimBlob& blob) {
+        WimBlob entry = blob;
+        WimReader::CopyRaw(in, entry.res.offset, entry.res.size_in_wim, sink);
+        entry.res.offset = offset;
+        entry.part_number = 1;
+        table.resize(table.size() + kWimLookupEntrySize);
+        WriteLookupEntry(table.data() + table.size() - kWimLookupEntrySize, entry);
+        offset += entry.res.size_in_wim;
+        return entry.res;
+    };
+    for (const auto& path : parts) {
+        WimReader part(path);
+        std::ifstream in = part.Open();
+        for (size_t i = 0; i < part.Metadata().size(); ++i) {
+            WimResHdr res = copy(in, part.Metadata()[i]);
+            if (i + 1 == header.boot_index) header.boot_metadata = res;
+        }
+        for (const auto& blob : part.Blobs()) copy(in, blob);
+    }
+    std::ifstream first_in = first.Open();
+    std::vector<uint8_t> xml = first.ReadResource(first_in, header.xml_data);
+    sink(table.data(), table.size());
+    sink(xml.data(), xml.size());
+    header.flags &= ~kWimFlagSpanned;
+    header.part_number = header.total_parts = 1;
+    header.lookup_table = {table.size(), 0, offset, table.size()};
+    header.xml_data = {xml.size(), 0, offset + table.size(), xml.size()};
+    header.integrity = WimResHdr();
+    auto header_bytes = SerializeWimHeader(header);
+    out.seekp(0);
+    sink(header_bytes.data(), header_bytes.size());
+}
+
+// 分卷后每个资源都在新的位置：拼回单个WIM后两个版本都必须释放出期望的目录树
+static void TestSplit(const fs::path& fixtures, const fs::path& work) {
+    std::cout << "[TEST] split multi_lzx.wim and apply the rebuilt image" << std::endl;
+    const fs::path dir = work / "split";
+    fs::create_directories(dir);
+    std::vector<StagedFile> parts = WriteSplitWim(fixtures / "multi_lzx.wim", dir / "install.swm", 100000);
+    EXPECT(parts.size() > 1, "install.wim was not split");
+    std::vector<fs::path> paths;
+    for (const auto& part : parts) paths.push_back(part.path);
+    MergeSwm(paths, dir / "merged.wim");
+    Apply(dir / "merged.wim", 1, dir / "image1");
+    ExpectSameTree(fixtures / "expected", dir / "image1");
+    Apply(dir / "merged.wim", 2, dir / "image2");
+    ExpectSameTree(fixtures / "expected2", dir / "image2");
+}
+
+// 真实工具以 XPRESS 和 LZX 压缩的镜像：期望目录树相同，hl1.exe/hl2.exe 为硬链接
+static void TestRealTool(const fs::path& fixtures, const fs::path& work) {
+    for (const char* name : {"xpress", "lzx"}) {
+        const fs::path wim_path = fixtures / "real" / (std::string(name) + ".wim");
+        if (!fs::exists(wim_path)) {
+            std::cout << "[SKIP] " << wim_path << " not found (run tests/fixtures/mkreal.sh)" << std::endl;
+            continue;
+        }
+        std::cout << "[TEST] apply real/" << name << ".wim" << std::endl;
+        const fs::path target = work / "real" / name;
+        WimApplyStats stats = Apply(wim_path, 1, target);
+        ExpectSameTree(fixtures / "expected", target);
+        EXPECT(fs::equivalent(target / "Windows" / "hl1.exe", target / "Windows" / "hl2.exe"),
+               "real/" << name << ": hl1/hl2 not linked");
+        EXPECT(stats.decoded_blobs == DistinctBlobs(fixtures / "expected"), "real/" << name << ": decoded " << stats.decoded_blobs);
+    }
+}
+
+static long long TimeMs(const std::function<void()>& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 同一镜像分别用原生引擎和7z释放（7z不在PATH中时只测原生），结果目录必须一致
+static void Bench(const fs::path& wim_path, const fs::path& work) {
+    WimApplyStats stats;
+    long long native_ms = TimeMs([&] { stats = Apply(wim_path, 1, work / "native"); });
+    std::cout << "[BENCH] native: " << stats.files << " files, " << (stats.bytes >> 20) << " MB, " << native_ms << " ms"
+              << std::endl;
+    if (std::system("command -v 7z >/dev/null 2>&1") != 0) {
+        std::cout << "[BENCH] 7z: not found, skipped" << std::endl;
+        return;
+    }
+    std::error_code ec;
+    fs::remove_all(work / "7z", ec);
+    std::string cmd = "7z x \"" + wim_path.string() + "\" -o\"" + (work / "7z").string() + "\" -y >/dev/null";
+    int rc = 0;
+    long long sevenzip_ms = TimeMs([&] { rc = std::system(cmd.c_str()); });
+    EXPECT(rc == 0, "7z failed");
+    std::cout << "[BENCH] 7z: " << sevenzip_ms << " ms, 7z/native = " << std::fixed << std::setprecision(2)
+              << double(sevenzip_ms) / std::max(1LL, native_ms) << std::endl;
+    // 7z会把重解析点和命名数据流作为额外文件释放，只检查原生结果都在7z结果中
+    for (const auto& e : fs::recursive_directory_iterator(work / "native")) {
+        fs::path rel = fs::relative(e.path(), work / "native");
+        if (e.is_regular_file()) EXPECT(ReadAll(e.path()) == ReadAll(work / "7z" / rel), "7z differs: " << rel);
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        if (argc == 4 && std::string(argv[1]) == "--bench") {
+            Bench(argv[2], argv[3]);
+        } else if (argc == 3) {
+            TestApply(argv[1], argv[2]);
+            TestSplit(argv[1], argv[2]);
+            TestRealTool(argv[1], argv[2]);
+        } else {
+            std::cerr << "usage: wim_apply_test <fixtures> <work> | --bench <file.wim> <work>" << std::endl;
+            return 2;
+        }
+    } catch (const std::exception& e) {
+        std::cout << "[FAIL] " << e.what() << std::endl;
+        ++failures;
+    }
+    Executor::Instance().Report("test");
+    return TestResult();
+}
@@ -5,6 +5,7 @@ import '../services/installer_service.dart';
 
 enum SystemType { win10, win11, custom }
 enum InstallStatus { idle, preparing, downloading, installing, completed, error }
+enum PrefetchStatus { idle, running, ready, error }
 
 class InstallerProvider extends ChangeNotifier {
   SystemType _selectedSystem = SystemType.win10;
@@ -16,6 +17,12 @@ class InstallerProvider extends ChangeNotifier {
   String _currentStep = '';
   String _errorMessage = '';
   bool _isAdminMode = false;
+  bool _prefetchEnabled = false;
+  String _rateLimit = ''; // 空表示不限速
+  PrefetchStatus _prefetchStatus = PrefetchStatus.idle;
+  double _prefetchProgress = 0.0;
+  String _prefetchMessage = '';
+  int _prefetchGeneration = 0;
   late final InstallerService _installerService;
 
   InstallerProvider() {
@@ -32,6 +39,11 @@ class InstallerProvider extends ChangeNotifier {
   String get currentStep => _currentStep;
   String get errorMessage => _errorMessage;
   bool get isAdminMode => _isAdminMode;
+  bool get prefetchEnabled => _prefetchEnabled;
+  String get rateLimit => _rateLimit;
+  PrefetchStatus get prefetchStatus => _prefetchStatus;
+  double get prefetchProgress => _prefetchProgress;
+  String get prefetchMessage => _prefetchMessage;
 
   // Setters
   void setSystemType(SystemType type) {
@@ -41,23 +53,27 @@ class InstallerProvider extends ChangeNotifier {
       _imageIndex = 4; // 预设模式固定索引4
     }
     notifyListeners();
+    _invalidatePrefetch();
   }
 
   void setCustomImagePath(String path) {
     _customImagePath = path;
     notifyListeners();
+    _invalidatePrefetch();
   }
 
   void setImageIndex(int index) {
     if (index > 0) {
       _imageIndex = index;
       notifyListeners();
+      _invalidatePrefetch();
     }
   }
 
   void setBackupDrivers(bool value) {
     _backupDrivers = value;
     notifyListeners();
+    _invalidatePrefetch();
   }
 
   void setStatus(InstallStatus newStatus) {
@@ -85,6 +101,56 @@ class InstallerProvider extends ChangeNotifier {
     notifyListeners();
   }
 
+  void setPrefetchStatus(PrefetchStatus value) {
+    _prefetchStatus = value;
+    notifyListeners();
+  }
+
+  void setPrefetchProgress(double value) {
+    _prefetchProgress = value;
+    notifyListeners();
+  }
+
+  void setPrefetchMessage(String message) {
+    _prefetchMessage = message;
+    notifyListeners();
+  }
+
+  void setRateLimit(String value) {
+    _rateLimit = value;
+    notifyListeners();
+  }
+
+  // 开启后台预取时立即开始，关闭时停止正在运行的预取
+  Future<void> setPrefetchEnabled(bool value) async {
+    _prefetchEnabled = value;
+    notifyListeners();
+    if (value) {
+      await startPrefetch();
+    } else {
+      await _installerService.cancelPrefetch();
+      _prefetchStatus = PrefetchStatus.idle;
+      _prefetchMessage = '';
+      notifyListeners();
+    }
+  }
+
+  // 镜像、版本或驱动选项改变后，预取结果不再对应当前配置：停止正在运行的预取并清除状态，
+  // 开启了后台预取时按新配置重新开始。连续修改时只有最后一次会重新启动
+  Future<void> _invalidatePrefetch() async {
+    if (!_prefetchEnabled && _prefetchStatus == PrefetchStatus.idle) return;
+    final generation = ++_prefetchGeneration;
+    await _installerService.cancelPrefetch();
+    if (generation != _prefetchGeneration) return;
+    _prefetchStatus = PrefetchStatus.idle;
+    _prefetchProgress = 0.0;
+    _prefetchMessage = '';
+    notifyListeners();
+    if (_prefetchEnabled) {
+      await startPrefetch();
+    }
+  }
+
   // 检查管理员权限
   Future<bool> checkAdminPrivileges() async {
     try {
@@ -125,6 +191,22 @@ class InstallerProvider extends ChangeNotifier {
     notifyListeners();
   }
 
+  // 后台预取：提前下载、校验并处理镜像，结果由安装程序的阶段日志复用
+  Future<void> startPrefetch() async {
+    if (!_isAdminMode) {
+      setPrefetchMessage('需要管理员权限');
+      return;
+    }
+
+    final validation = validateConfiguration();
+    if (validation != null) {
+      setPrefetchMessage(validation);
+      return;
+    }
+
+    await _installerService.runPrefetch();
+  }
+
   // 开始安装
   Future<void> startInstallation() async {
     if (!_isAdminMode) {
@@ -143,6 +225,8 @@ class InstallerProvider extends ChangeNotifier {
       setProgress(0.0);
       setCurrentStep('准备安装环境...');
 
+      // 预取与安装共用同一工作目录，先停止预取，已完成的阶段会被安装程序跳过
+      await _installerService.cancelPrefetch();
       await _installerService.runInstaller();
     } catch (e) {
       setStatus(InstallStatus.error);
@@ -5,6 +5,7 @@ import '../providers/installer_provider.dart';
 import '../widgets/system_selection.dart';
 import '../widgets/image_settings.dart';
 import '../widgets/driver_management.dart';
+import '../widgets/prefetch_settings.dart';
 import '../widgets/progress_section.dart';
 import '../widgets/action_buttons.dart';
 
@@ -115,6 +116,26 @@ class _HomeScreenState extends State<HomeScreen> {
               ),
             ),
             const SizedBox(height: 16),
+            const Card(
+              child: Padding(
+                padding: EdgeInsets.all(16.0),
+                child: Column(
+                  crossAxisAlignment: CrossAxisAlignment.start,
+                  children: [
+                    Text(
+                      '后台预取',
+                      style: TextStyle(
+                        fontSize: 18,
+                        fontWeight: FontWeight.bold,
+                      ),
+                    ),
+                    SizedBox(height: 16),
+                    PrefetchSettings(),
+                  ],
+                ),
+              ),
+            ),
+            const SizedBox(height: 16),
             const Card(
               child: Padding(
                 padding: EdgeInsets.all(16.0),
@@ -14,11 +14,99 @@ class InstallerService {
   static const double _isoDownloadWeight = 0.3;  // 30% 用于ISO下载
   static const double _installWeight = 0.4;      // 40% 用于实际安装
   
-  // 安装阶段的步骤总数（根据WinInstaller.cpp中的ExecuteCommand调用次数）
-  static const int _totalInstallingSteps = 7; // Rename.cmd, CreatPE.cmd, 7z, xcopy install.wim, xcopy script.cmd, xcopy DelPE.cmd, boot.cmd
+  // 安装阶段的步骤总数（根据WinInstaller.cpp中的ExecuteCommand调用次数，原生步骤以"native:"开头）
+  static const int _totalInstallingSteps = 7; // Rename.cmd, CreatPE.cmd, 释放boot.wim, xcopy install.wim, xcopy script.cmd, xcopy DelPE.cmd, boot.cmd
   
+  Process? _prefetchProcess;
+  int _prefetchToken = 0; // 每次启动或取消预取时递增
+
   InstallerService(this.provider);
 
+  // 以低优先级运行安装程序的预取模式，只执行下载与镜像处理阶段
+  Future<void> runPrefetch() async {
+    if (_prefetchProcess != null) return;
+
+    final args = _buildArguments()..addAll(['--prefetch', 'true']);
+    if (provider.rateLimit.isNotEmpty) {
+      args.addAll(['--ratelimit', provider.rateLimit]);
+    }
+
+    try {
+      provider.setPrefetchStatus(PrefetchStatus.running);
+      provider.setPrefetchProgress(0.0);
+      provider.setPrefetchMessage('正在后台预取镜像...');
+
+      final token = ++_prefetchToken;
+      final process = await Process.start(
+        'WinInstaller.exe',
+        args,
+        runInShell: true,
+      );
+      if (token != _prefetchToken) {
+        // 启动期间已被取消（例如配置又改了），不能留下无人管理的进程
+        await _killProcessTree(process);
+        return;
+      }
+      _prefetchProcess = process;
+
+      process.stdout.transform(const SystemEncoding().decoder).listen((data) {
+        _handlePrefetchOutput(data);
+      });
+      process.stderr.transform(const SystemEncoding().decoder).listen((data) {
+        provider.setPrefetchMessage(data.trim());
+      });
+
+      final exitCode = await process.exitCode;
+      if (_prefetchProcess != process) return; // 已被取消
+      _prefetchProcess = null;
+      if (exitCode == 0) {
+        provider.setPrefetchStatus(PrefetchStatus.ready);
+        provider.setPrefetchProgress(1.0);
+        provider.setPrefetchMessage('镜像与PE文件已就绪，开始安装时只需分区并复制到PE分区');
+      } else {
+        provider.setPrefetchStatus(PrefetchStatus.error);
+        provider.setPrefetchMessage('预取失败，退出代码：$exitCode');
+      }
+    } catch (e) {
+      _prefetchProcess = null;
+      provider.setPrefetchStatus(PrefetchStatus.error);
+      provider.setPrefetchMessage('启动预取失败：$e');
+    }
+  }
+
+  // 停止正在运行的预取（包括它启动的curl/7z/dism等子进程）
+  Future<void> cancelPrefetch() async {
+    _prefetchToken++;
+    final process = _prefetchProcess;
+    if (process == null) return;
+    _prefetchProcess = null;
+    await _killProcessTree(process);
+  }
+
+  Future<void> _killProcessTree(Process process) async {
+    try {
+      await Process.run('taskkill', ['/PID', process.pid.toString(), '/T', '/F'], runInShell: true);
+    } catch (_) {
+      process.kill();
+    }
+    await process.exitCode;
+  }
+
+  void _handlePrefetchOutput(String data) {
+    if (data.contains('[EXEC]')) {
+      provider.setPrefetchMessage(data.replaceAll('[EXEC]', '').trim());
+    } else if (data.contains('已完成，跳过')) {
+      provider.setPrefetchMessage(data.replaceAll('[INFO]', '').trim());
+    }
+
+    final percentStr = RegExp(r'(\d+)%').firstMatch(data)?.group(1);
+    if (percentStr != null) {
+      final percent = (int.parse(percentStr) / 100).clamp(0.0, 1.0).toDouble();
+      // 下载占预取的大部分时间
+      provider.setPrefetchProgress(percent * 0.9);
+    }
+  }
+
   Future<void> runInstaller() async {
     final args = _buildArguments();
     
@@ -98,7 +186,7 @@ class InstallerService {
       provider.setCurrentStep(step);
       
       // 检查是否进入安装阶段
-      if (step.contains('tools\\')) {
+      if (step.contains('tools\\') || step.startsWith('native:')) {
         if (!_isInstallingPhase) {
           _isInstallingPhase = true;
           provider.setStatus(InstallStatus.installing);
@@ -108,7 +196,7 @@ class InstallerService {
         
         // 计算安装阶段的进度
         final baseProgress = _preparationWeight + _peDownloadWeight + _isoDownloadWeight;
-        final stepProgress = _installWeight * (_installingStepCount / _totalInstallingSteps);
+        final stepProgress = _installWeight * (_installingStepCount / _totalInstallingSteps).clamp(0.0, 1.0);
         _updateProgress(baseProgress + stepProgress);
       }
     }
@@ -123,7 +211,8 @@ class InstallerService {
         // ISO下载开始
         _updateProgress(_preparationWeight + _peDownloadWeight + (_isoDownloadWeight * 0.1));
       }
-    } else if (data.contains('MD5验证通过')) {
+    } else if (data.contains('MD5验证通过') || data.contains('镜像校验通过')) {
+      // 远程只下载install.wim时没有整包MD5，输出“镜像校验通过”
       if (data.toLowerCase().contains('boot.wim')) {
         // PE下载完成
         _updateProgress(_preparationWeight + _peDownloadWeight);
@@ -0,0 +1,89 @@
+import 'package:flutter/material.dart';
+import 'package:provider/provider.dart';
+import '../providers/installer_provider.dart';
+
+class PrefetchSettings extends StatelessWidget {
+  const PrefetchSettings({super.key});
+
+  static const Map<String, String> _rateLimits = {
+    '': '不限速',
+    '1M': '1 MB/s',
+    '5M': '5 MB/s',
+    '10M': '10 MB/s',
+  };
+
+  @override
+  Widget build(BuildContext context) {
+    return Consumer<InstallerProvider>(
+      builder: (context, provider, child) {
+        final bool isRunning = provider.prefetchStatus == PrefetchStatus.running;
+
+        return Column(
+          crossAxisAlignment: CrossAxisAlignment.start,
+          children: [
+            SwitchListTile(
+              title: const Text('后台预取镜像'),
+              subtitle: const Text('以低优先级提前下载、校验并处理镜像，开始安装时只需写入PE分区'),
+              value: provider.prefetchEnabled,
+              onChanged: provider.status == InstallStatus.idle
+                  ? (bool value) {
+                      provider.setPrefetchEnabled(value);
+                    }
+                  : null,
+            ),
+            Padding(
+              padding: const EdgeInsets.symmetric(horizontal: 16),
+              child: Row(
+                children: [
+                  const Text('下载限速：'),
+                  const SizedBox(width: 8),
+                  DropdownButton<String>(
+                    value: provider.rateLimit,
+                    // 限速在启动预取时传给安装程序，运行中不可修改
+                    onChanged: isRunning
+                        ? null
+                        : (String? value) {
+                            provider.setRateLimit(value ?? '');
+                          },
+                    items: _rateLimits.entries
+                        .map((e) => DropdownMenuItem<String>(
+                              value: e.key,
+                              child: Text(e.value),
+                            ))
+                        .toList(),
+                  ),
+                ],
+              ),
+            ),
+            if (provider.prefetchEnabled) ...[
+              const SizedBox(height: 8),
+              Padding(
+                padding: const EdgeInsets.symmetric(horizontal: 16),
+                child: Column(
+                  crossAxisAlignment: CrossAxisAlignment.start,
+                  children: [
+                    LinearProgressIndicator(
+                      value: provider.prefetchProgress,
+                      backgroundColor: Colors.grey[200],
+                      valueColor: AlwaysStoppedAnimation<Color>(
+                        provider.prefetchStatus == PrefetchStatus.error ? Colors.red : Colors.blue,
+                      ),
+                    ),
+                    const SizedBox(height: 8),
+                    Text(
+                      provider.prefetchMessage,
+                      style: TextStyle(
+                        color: provider.prefetchStatus == PrefetchStatus.error ? Colors.red : Colors.grey,
+                        fontSize: 12,
+                      ),
+                    ),
+                  ],
+                ),
+              ),
+            ],
+          ],
+        );
+      },
+    );
+  }
+}